@@ -1,9 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
+#include <assert.h>
 #include "sierpinski.h"
 #include "diamond_square.h"
 #include "bmp.h"
+#include "layer.h"
+#include "dither.h"
+#include "png.h"
+#include "pyramid.h"
+#include "canvas.h"
 
 // Sierpinski's triangle, drawn out in inverted colors on a cloud fractal
 // background.
@@ -27,20 +34,180 @@ int demo1() {
     draw_sier_triangle(B, 2*border, 2*border, width - 4*border, height - 4*border,
             sier1, sier2);
 
-    // Write image and clean up
+    // Write image (as a BMP and a PNG) and clean up
     bmp_write("demo1.bmp", B);
+    bmp_write_png("demo1.png", B);
     DrawFn_free(sier1);
     DrawFn_free(sier2);
     DrawFn_free(bg);
     bmp_free(B);
 }
 
+// A cloud fractal background with a Sierpinski carpet multiplied over it and a
+// translucent anti-aliased Sierpinski triangle screened on top.
+int demo2() {
+    int width = 1920;
+    int height = 1920;
+    BitmapImage* B = bmp_create(width, height);
+    Layer* carpet = layer_create(B, 0.7, BLEND_MULTIPLY);
+    Layer* triangle = layer_create(B, 0.6, BLEND_SCREEN);
+
+    // Set up draw functions
+    DrawFn* bg = DrawFn_init_diamondsquare(0, 0, width, height,
+            16, 48, 96, 224, 208, 160);
+    DrawFn* tint = DrawFn_init_rgb(255, 160, 64);
+    DrawFn* glow = DrawFn_init_rgb(96, 192, 255);
+    DrawFn* erase = DrawFn_init_erase();
+
+    // Draw each layer, then composite them all at once.
+    bmp_drawrect(B, 0, 0, width, height, bg);
+    draw_sier_carpet(carpet->img, 0, 0, width, height, tint, erase);
+    draw_sier_triangle_aa(triangle->img, 96.5, 96.5, width - 193, height - 193,
+            glow, erase);
+    Layer* layers[] = { carpet, triangle };
+    layer_flatten(B, layers, 2);
+
+    // Write image, and a copy dithered down to eight colors
+    bmp_write("demo2.bmp", B);
+    BitmapPixel palette[] = {
+        { .r = 16,  .g = 24,  .b = 40  },
+        { .r = 48,  .g = 72,  .b = 112 },
+        { .r = 96,  .g = 144, .b = 192 },
+        { .r = 168, .g = 208, .b = 240 },
+        { .r = 96,  .g = 64,  .b = 32  },
+        { .r = 176, .g = 120, .b = 56  },
+        { .r = 232, .g = 184, .b = 112 },
+        { .r = 248, .g = 240, .b = 224 },
+    };
+    bmp_dither(B, palette, 8, DITHER_FLOYD_STEINBERG);
+    bmp_write("demo2_dithered.bmp", B);
+
+    // Clean up
+    DrawFn_free(erase);
+    DrawFn_free(glow);
+    DrawFn_free(tint);
+    DrawFn_free(bg);
+    layer_free(triangle);
+    layer_free(carpet);
+    bmp_free(B);
+}
+
+// A Koch snowflake on a cloud fractal background, its two halves clipped to
+// different colors, with a self-crossing star filled under each rule:
+// even-odd leaves its center pentagon empty, nonzero fills it.
+int demo3() {
+    int width = 1920;
+    int height = 1920;
+    BitmapImage* B = bmp_create(width, height);
+
+    // Set up draw functions
+    DrawFn* bg = DrawFn_init_diamondsquare(0, 0, width, height,
+            24, 32, 64, 96, 112, 160);
+    DrawFn* snow = DrawFn_init_rgb(232, 240, 255);
+    DrawFn* shade = DrawFn_init_rgb(176, 196, 232);
+    DrawFn* star = DrawFn_init_rgb(255, 192, 64);
+
+    bmp_drawrect(B, 0, 0, width, height, bg);
+
+    // Build the snowflake by replacing each edge of a triangle with four, six
+    // times over.
+    int depth = 6;
+    int n = 3;
+    BitmapPoint* P = malloc(sizeof(BitmapPoint) * 3 * (1 << (2 * depth)));
+    BitmapPoint* Q = malloc(sizeof(BitmapPoint) * 3 * (1 << (2 * depth)));
+    assert(P && Q);
+    for (int i = 0; i < 3; i++) {
+        double a = M_PI / 2 + i * 2 * M_PI / 3;
+        P[i].x = width / 2 + 640 * cos(a);
+        P[i].y = height * 0.6 + 640 * sin(a);
+    }
+    for (int k = 0; k < depth; k++) {
+        for (int i = 0; i < n; i++) {
+            BitmapPoint p = P[i], q = P[(i + 1) % n];
+            double dx = (q.x - p.x) / 3, dy = (q.y - p.y) / 3;
+            Q[4*i] = p;
+            Q[4*i + 1] = (BitmapPoint){ p.x + dx, p.y + dy };
+            Q[4*i + 2] = (BitmapPoint){
+                p.x + 1.5 * dx + dy * sqrt(3) / 2,
+                p.y + 1.5 * dy - dx * sqrt(3) / 2 };
+            Q[4*i + 3] = (BitmapPoint){ p.x + 2 * dx, p.y + 2 * dy };
+        }
+        n *= 4;
+        BitmapPoint* tmp = P;
+        P = Q;
+        Q = tmp;
+    }
+    bmp_pushclip(B, 0, 0, width / 2, height);
+    bmp_drawpolygon(B, P, n, snow, FILL_NONZERO);
+    bmp_popclip(B);
+    bmp_pushclip(B, width / 2, 0, width - width / 2, height);
+    bmp_drawpolygon(B, P, n, shade, FILL_NONZERO);
+    bmp_popclip(B);
+
+    // Two five-pointed stars, drawn by joining every second point.
+    for (int s = 0; s < 2; s++) {
+        BitmapPoint pts[5];
+        for (int i = 0; i < 5; i++) {
+            double a = -M_PI / 2 + i * 4 * M_PI / 5;
+            pts[i].x = width * (s ? 0.8 : 0.2) + 160 * cos(a);
+            pts[i].y = height * 0.14 + 160 * sin(a);
+        }
+        bmp_drawpolygon(B, pts, 5, star, s ? FILL_NONZERO : FILL_EVENODD);
+    }
+
+    // Write image, and again as tiles for a deep zoom viewer, and clean up
+    bmp_write("demo3.bmp", B);
+    bmp_write_pyramid("demo3_tiles", B, 256);
+    free(Q);
+    free(P);
+    DrawFn_free(star);
+    DrawFn_free(shade);
+    DrawFn_free(snow);
+    DrawFn_free(bg);
+    bmp_free(B);
+}
+
+// Draws a Sierpinski triangle depth levels deep on a canvas.
+static void demo4_sier(TiledCanvas* C, int64_t x1, int64_t y1, int64_t x2,
+        int64_t y2, int64_t x3, int64_t y3, int depth, DrawFn* d) {
+    if (depth == 0) {
+        canvas_drawtriangle(C, x1, y1, x2, y2, x3, y3, d);
+        return;
+    }
+    int64_t x12 = (x1 + x2) / 2, y12 = (y1 + y2) / 2;
+    int64_t x23 = (x2 + x3) / 2, y23 = (y2 + y3) / 2;
+    int64_t x13 = (x1 + x3) / 2, y13 = (y1 + y3) / 2;
+    demo4_sier(C, x1, y1, x12, y12, x13, y13, depth - 1, d);
+    demo4_sier(C, x12, y12, x2, y2, x23, y23, depth - 1, d);
+    demo4_sier(C, x13, y13, x23, y23, x3, y3, depth - 1, d);
+}
+
+// A Sierpinski triangle on a 4096 x 4096 tiled canvas, written out as a tile
+// pyramid.  Only the tiles the triangle touches are ever allocated.
+int demo4() {
+    int64_t size = 4096;
+    TiledCanvas* C = canvas_create(size, size, 512, 16, 16, 24);
+    DrawFn* grad = DrawFn_init_axialgradient(0, 0, (int)size, (int)size,
+            (int)size, 0,
+            255, 160, 64, 96, 32, 160);
+
+    demo4_sier(C, 0, 0, size / 2, size - 1, size - 1, 0, 8, grad);
+
+    // Write tiles and clean up
+    canvas_write_pyramid("demo4_tiles", C, 256);
+    DrawFn_free(grad);
+    canvas_free(C);
+}
+
 int main(int argc, char* argv[]) {
     // Set up
     srand(clock());
 
     // Run demos
     demo1();
+    demo2();
+    demo3();
+    demo4();
 
     return 0;
 }
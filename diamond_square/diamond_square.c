@@ -11,24 +11,39 @@
 // (https://en.wikipedia.org/wiki/Diamond-square_algorithm)
 //
 
-#ifndef _DIAMONDSQUARE_H_
-#define _DIAMONDSQUARE_H_
+#ifndef _DIAMONDSQUARE_C_
+#define _DIAMONDSQUARE_C_
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <math.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bmp.h"
+#include "parallel.h"
+#include "diamond_square.h"
 
 typedef struct diamond_square {
-    int** topography;
-    int maxh;       // Maximum value of a height
+    uint16_t** topography;  // Row pointers into heights
+    uint16_t* heights;      // All dim x dim heights, row after row
+    int maxh;       // Maximum value of a height (at most UINT16_MAX)
     int dim;        // Array row/col count
     int max_steps;  // The total number of steps that can be taken
+    unsigned int rng;   // Random state (for rand_r)
+    double roughness;   // Random magnitude multiplier from step to step
+    void* map;      // If the heights were mapped in from the cache, the
+    size_t maplen;  // mapping to unmap; otherwise NULL.
 } ds_t;
 
 #define round(x) (int)(x+0.5)
-#define random() ((double)rand()) / (double)INT_MAX // Random value on [0,1]
+#define ds_random(T) ((double)rand_r(&(T)->rng) / (double)RAND_MAX) // On [0,1]
 
 ////////////////////////////////////////////////////////////////////////////////
 // The diamond-square algorithm ////////////////////////////////////////////////
@@ -60,7 +75,7 @@ void d_s_recurse(ds_t* T,int steps_remaining,int random_magnitude) {
     // corners plus a random offset
     for (int i = step_size; i < T->dim; i += 2*step_size) {
         for (int j = step_size; j < T->dim; j += 2*step_size) {
-            int r = round(random() * random_magnitude) - (random_magnitude / 2);
+            int r = round(ds_random(T) * random_magnitude) - (random_magnitude / 2);
             int sum_elev = T->topography[i - step_size][j - step_size] +
                 T->topography[i + step_size][j - step_size] +
                 T->topography[i - step_size][j + step_size] +
@@ -77,7 +92,7 @@ void d_s_recurse(ds_t* T,int steps_remaining,int random_magnitude) {
     for (int i = 0; i < T->dim; i += step_size) {
         int j = (!((i / step_size) % 2)) * step_size;
         for (; j < T->dim; j += 2*step_size) {
-            int r = round(random() * random_magnitude) - (random_magnitude / 2);
+            int r = round(ds_random(T) * random_magnitude) - (random_magnitude / 2);
             int n_corners = (i != 0) + (j != 0) + (i != T->dim - 1) + (j != T->dim - 1);
 
             int sum_elev = (i != 0) ? T->topography[i - step_size][j] : 0;
@@ -91,7 +106,7 @@ void d_s_recurse(ds_t* T,int steps_remaining,int random_magnitude) {
             T->topography[i][j] = height;
         }
     }
-    d_s_recurse(T,steps_remaining - 1, random_magnitude / 2);
+    d_s_recurse(T,steps_remaining - 1, (int)(random_magnitude * T->roughness));
 
     return;
 }
@@ -104,38 +119,285 @@ void d_s(ds_t* T) {
     T->topography[0][T->dim-1] = initial;
     T->topography[T->dim-1][0] = initial;
     T->topography[T->dim-1][T->dim-1] = initial;*/
-    T->topography[0][0] = (int)(random() * T->maxh);
-    T->topography[0][T->dim-1] = (int)(random() * T->maxh);
-    T->topography[T->dim-1][0] = (int)(random() * T->maxh);
-    T->topography[T->dim-1][T->dim-1] = (int)(random() * T->maxh);
+    T->topography[0][0] = (int)(ds_random(T) * T->maxh);
+    T->topography[0][T->dim-1] = (int)(ds_random(T) * T->maxh);
+    T->topography[T->dim-1][0] = (int)(ds_random(T) * T->maxh);
+    T->topography[T->dim-1][T->dim-1] = (int)(ds_random(T) * T->maxh);
 
     return d_s_recurse(T,T->max_steps,T->maxh / 2);
 }
 
 
-ds_t* new_ds(unsigned int pxdim, int maxh, int square_size) {
-    ds_t* T = malloc(sizeof(ds_t));
+// Sets up a ds_t with row pointers into heights, which must hold dim x dim
+// values.
+static ds_t* alloc_ds(int dim, int maxh, uint16_t* heights) {
+    assert(maxh > 0 && maxh <= UINT16_MAX);
+    ds_t* T = calloc(sizeof(ds_t), 1);
+    assert(T);
 
-    int min_dim = pxdim / square_size;
     T->maxh = maxh;
-    T->max_steps = steps_from_dim(min_dim);
-    T->dim = dim_from_steps(T->max_steps);
+    T->max_steps = steps_from_dim(dim);
+    T->dim = dim;
+    T->heights = heights;
+    T->topography = malloc(sizeof(uint16_t*) * T->dim);
+    assert(T->topography);
+    for (int i = 0; i < T->dim; i++) T->topography[i] = &heights[(size_t)i * dim];
 
-    T->topography = malloc(sizeof(int*) * T->dim);
-    for (int i = 0; i < T->dim; i++) T->topography[i] = malloc(sizeof(int) * T->dim);
+    return T;
+}
+
+static int ds_dim(unsigned int pxdim, int square_size) {
+    int min_dim = pxdim / square_size;
+    return dim_from_steps(steps_from_dim(min_dim));
+}
+
+static ds_t* generate_ds(int dim, int maxh, uint32_t seed, double roughness) {
+    uint16_t* heights = malloc(sizeof(uint16_t) * (size_t)dim * dim);
+    assert(heights);
+    ds_t* T = alloc_ds(dim, maxh, heights);
+    T->rng = seed;
+    T->roughness = roughness;
 
     d_s(T);
 
     return T;
 }
 
+static ds_t* ds_cache_lookup(int dim, int maxh, uint32_t seed, double roughness);
+static void ds_cache_store(ds_t* T, uint32_t seed);
+
+// Generate (or fetch from the heightmap cache, if one is configured) the
+// surface for the given seed.  roughness scales the random offsets from each
+// step to the next; 0.5 is the classic algorithm.
+ds_t* new_ds_seeded(unsigned int pxdim, int maxh, int square_size,
+        uint32_t seed, double roughness) {
+    int dim = ds_dim(pxdim, square_size);
+    ds_t* T = ds_cache_lookup(dim, maxh, seed, roughness);
+    if (T) return T;
+
+    T = generate_ds(dim, maxh, seed, roughness);
+    ds_cache_store(T, seed);
+    return T;
+}
+
+// Generate a fresh random surface.  These are never cached.
+ds_t* new_ds(unsigned int pxdim, int maxh, int square_size) {
+    return generate_ds(ds_dim(pxdim, square_size), maxh, (uint32_t)rand(), 0.5);
+}
+
 void free_ds(ds_t* T) {
-    for (int i = 0; i < T->dim; i++) free(T->topography[i]);
+    if (T->map) {
+        munmap(T->map, T->maplen);
+    } else {
+        free(T->heights);
+    }
     free(T->topography);
     free(T);
     return;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Heightmap cache /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Generated surfaces can be kept on disk, keyed by everything that determines
+// them (seed, dim, maxh, roughness), so that re-rendering the same terrain
+// skips generation and maps the heights straight in.  Each entry is a small
+// header followed by the raw 16-bit heights.  Entries are written to a
+// temporary file and renamed into place, checked against their header and
+// checksum when loaded (bad entries are deleted), and evicted oldest-used
+// first once the directory grows past its size cap.
+
+#define DS_CACHE_VERSION 1
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t sig[4];     // "DSHM"
+    uint32_t version;
+    uint32_t seed;
+    uint32_t dim;
+    uint32_t maxh;
+    uint32_t reserved;
+    double roughness;
+    uint64_t checksum;  // Of the heights; see ds_checksum
+} ds_cache_header;
+
+_Static_assert(sizeof(ds_cache_header) == 40, "ds_cache_header is part of the file format");
+
+static char* ds_cache_dir = NULL;
+static uint64_t ds_cache_max_bytes = 0;
+
+void ds_cache_configure(const char* dir, uint64_t max_bytes) {
+    free(ds_cache_dir);
+    ds_cache_dir = NULL;
+    if (dir) {
+        ds_cache_dir = strdup(dir);
+        assert(ds_cache_dir);
+        mkdir(dir, S_IRWXU);
+    }
+    ds_cache_max_bytes = max_bytes;
+}
+
+// Fletcher-style checksum; cheap enough to run on every load.
+static uint64_t ds_checksum(const uint16_t* heights, size_t n) {
+    uint64_t a = 1, b = 0;
+    for (size_t i = 0; i < n; i++) {
+        a += heights[i];
+        b += a;
+    }
+    return (b << 32) ^ a;
+}
+
+static void ds_cache_path(char* path, size_t len, int dim, int maxh,
+        uint32_t seed, double roughness) {
+    uint64_t rbits;
+    memcpy(&rbits, &roughness, sizeof(rbits));
+    snprintf(path, len, "%s/ds_%08x_%d_%d_%016llx.hm", ds_cache_dir,
+            seed, dim, maxh, (unsigned long long)rbits);
+}
+
+static ds_t* ds_cache_lookup(int dim, int maxh, uint32_t seed, double roughness) {
+    if (!ds_cache_dir) return NULL;
+
+    char path[PATH_MAX];
+    ds_cache_path(path, sizeof(path), dim, maxh, seed, roughness);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    // Check the size before mapping anything.
+    size_t n = (size_t)dim * dim;
+    size_t expected = sizeof(ds_cache_header) + n * sizeof(uint16_t);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != expected) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    void* map = mmap(NULL, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    // Validate the header and the heights themselves.
+    ds_cache_header* hdr = map;
+    uint16_t* heights = (uint16_t*)((char*)map + sizeof(ds_cache_header));
+    if (memcmp(hdr->sig, "DSHM", 4) != 0 || hdr->version != DS_CACHE_VERSION ||
+            hdr->seed != seed || hdr->dim != (uint32_t)dim ||
+            hdr->maxh != (uint32_t)maxh ||
+            hdr->roughness != roughness ||
+            hdr->checksum != ds_checksum(heights, n)) {
+        munmap(map, expected);
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    // Mark as recently used for eviction.
+    futimens(fd, NULL);
+    close(fd);
+
+    ds_t* T = alloc_ds(dim, maxh, heights);
+    T->rng = seed;
+    T->roughness = roughness;
+    T->map = map;
+    T->maplen = expected;
+    return T;
+}
+
+typedef struct {
+    char* name;
+    off_t size;
+    struct timespec mtime;
+} ds_cache_entry;
+
+static int ds_cache_entry_cmp(const void* a, const void* b) {
+    const ds_cache_entry* A = a;
+    const ds_cache_entry* B = b;
+    if (A->mtime.tv_sec != B->mtime.tv_sec) {
+        return (A->mtime.tv_sec > B->mtime.tv_sec) - (A->mtime.tv_sec < B->mtime.tv_sec);
+    }
+    return (A->mtime.tv_nsec > B->mtime.tv_nsec) - (A->mtime.tv_nsec < B->mtime.tv_nsec);
+}
+
+// Deletes the least recently used entries until the cache fits its cap.
+static void ds_cache_evict() {
+    DIR* dir = opendir(ds_cache_dir);
+    if (!dir) return;
+
+    size_t count = 0, cap = 16;
+    ds_cache_entry* entries = malloc(sizeof(ds_cache_entry) * cap);
+    assert(entries);
+    uint64_t total = 0;
+    char path[PATH_MAX];
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+        size_t len = strlen(ent->d_name);
+        if (strncmp(ent->d_name, "ds_", 3) != 0 || len < 3 ||
+                strcmp(ent->d_name + len - 3, ".hm") != 0) {
+            continue;
+        }
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", ds_cache_dir, ent->d_name);
+        if (stat(path, &st) != 0) continue;
+        if (count == cap) {
+            cap *= 2;
+            entries = realloc(entries, sizeof(ds_cache_entry) * cap);
+            assert(entries);
+        }
+        entries[count].name = strdup(ent->d_name);
+        entries[count].size = st.st_size;
+        entries[count].mtime = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    qsort(entries, count, sizeof(ds_cache_entry), &ds_cache_entry_cmp);
+    for (size_t i = 0; i < count; i++) {
+        if (total > ds_cache_max_bytes) {
+            snprintf(path, sizeof(path), "%s/%s", ds_cache_dir, entries[i].name);
+            if (unlink(path) == 0) total -= entries[i].size;
+        }
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+static void ds_cache_store(ds_t* T, uint32_t seed) {
+    if (!ds_cache_dir) return;
+
+    size_t n = (size_t)T->dim * T->dim;
+    size_t datalen = n * sizeof(uint16_t);
+    if (sizeof(ds_cache_header) + datalen > ds_cache_max_bytes) return;
+
+    ds_cache_header hdr;
+    memcpy(hdr.sig, "DSHM", 4);
+    hdr.version = DS_CACHE_VERSION;
+    hdr.seed = seed;
+    hdr.dim = T->dim;
+    hdr.maxh = T->maxh;
+    hdr.reserved = 0;
+    hdr.roughness = T->roughness;
+    hdr.checksum = ds_checksum(T->heights, n);
+
+    // Write to a private temporary name, then rename into place so that no
+    // reader ever sees a partial entry.
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    ds_cache_path(path, sizeof(path), T->dim, T->maxh, seed, T->roughness);
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) return;
+    int ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        write(fd, T->heights, datalen) == (ssize_t)datalen;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    ds_cache_evict();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Drawing functions ///////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -200,7 +462,8 @@ void DrawFn_free_diamondsquare(DrawFn* d) {
     free_ds(d->mem);
 }
 
-DrawFn* DrawFn_init_diamondsquare(int x, int y, int w, int h,
+// T must have been generated for max(w, h) pixels.
+static DrawFn* internal_init_diamondsquare(int x, int y, int w, int h, ds_t* T,
         uint8_t r1, uint8_t g1, uint8_t b1,
         uint8_t r2, uint8_t g2, uint8_t b2) {
     // Initialize memory
@@ -210,14 +473,16 @@ DrawFn* DrawFn_init_diamondsquare(int x, int y, int w, int h,
     // Initialize functions
     d->pxfn = &DrawFn_drawpx_diamondsquare;
     d->freefn = &DrawFn_free_diamondsquare;
+    d->spanfn = NULL;
+    d->coverage = COVER_PAINT;
 
-    // Initialize other members and run the Diamond-Square algorithm.
+    // Initialize other members.
     //
     // Use x1, y1 to store top left; x2 to store w & h.
     d->x1 = x;
     d->y1 = y;
     d->x2 = (w > h) ? w : h;
-    d->mem = new_ds(d->x2, 1<<12, 1);
+    d->mem = T;
     d->r1 = r1;
     d->g1 = g1;
     d->b1 = b1;
@@ -227,6 +492,502 @@ DrawFn* DrawFn_init_diamondsquare(int x, int y, int w, int h,
     return d;
 }
 
+DrawFn* DrawFn_init_diamondsquare(int x, int y, int w, int h,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    // Run the Diamond-Square algorithm.
+    ds_t* T = new_ds((w > h) ? w : h, 1<<12, 1);
+    return internal_init_diamondsquare(x, y, w, h, T,
+            r1, g1, b1, r2, g2, b2);
+}
+
+DrawFn* DrawFn_init_diamondsquare_seeded(int x, int y, int w, int h,
+        uint32_t seed, double roughness,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    // Run the Diamond-Square algorithm, or fetch its result from the cache.
+    ds_t* T = new_ds_seeded((w > h) ? w : h, 1<<12, 1, seed, roughness);
+    return internal_init_diamondsquare(x, y, w, h, T,
+            r1, g1, b1, r2, g2, b2);
+}
+
+// Clips a span to a shader's area, [x1, x1+x2) x [y1, y1+x2).  Returns 0 if
+// none of it is left; otherwise sets the row and the columns [rx0, rx1) that
+// are, relative to the area's top left.
+static int ds_clip_span(DrawFn* d, unsigned int x, unsigned int y,
+        unsigned int len, int* ry, int* rx0, int* rx1) {
+    *ry = (int)y - d->y1;
+    if (*ry < 0 || *ry >= d->x2) return 0;
+    *rx0 = (int)x - d->x1;
+    if (*rx0 < 0) *rx0 = 0;
+    *rx1 = (int)(x + len) - d->x1;
+    if (*rx1 > d->x2) *rx1 = d->x2;
+    return *rx0 < *rx1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Hillshading /////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Lights the heightmap as terrain.  Normals come from central differences of
+// the four neighbors of each cell; the shaded colors for every cell are
+// computed once, up front, in a tiled stencil pass spread across threads.
+// Tiles keep the three heightmap rows the stencil reads hot in cache, and
+// bound the transposed writes into the (row-major) color buffer.  Drawing is
+// then a lookup per pixel.
+
+#define HILLSHADE_TILE 64
+
+typedef struct {
+    ds_t* T;
+    BitmapPixel* shade; // (dim-1) x (dim-1) colors, row major by pixel y
+    int cells;          // dim - 1
+    float light[3];     // Unit vector toward the sun
+    float ambient;
+    float slope_tint;
+    float zscale;       // Height units to cell units
+    uint8_t r1, g1, b1, r2, g2, b2;
+} hillshade_t;
+
+// Shades one tile of cells: columns [cx, cx+HILLSHADE_TILE) and rows
+// [cy, cy+HILLSHADE_TILE), clipped to the map.
+static void hillshade_tile(hillshade_t* H, int cx, int cy) {
+    ds_t* T = H->T;
+    int last = T->dim - 1;
+    int xend = (cx + HILLSHADE_TILE < H->cells) ? cx + HILLSHADE_TILE : H->cells;
+    int yend = (cy + HILLSHADE_TILE < H->cells) ? cy + HILLSHADE_TILE : H->cells;
+    float intensity[HILLSHADE_TILE];
+    float height[HILLSHADE_TILE];
+    float steep[HILLSHADE_TILE];
+
+    // topography is indexed [x][y], so walk y (contiguous) innermost.
+    for (int sx = cx; sx < xend; sx++) {
+        uint16_t* left = T->topography[(sx > 0) ? sx - 1 : 0];
+        uint16_t* mid = T->topography[sx];
+        uint16_t* right = T->topography[(sx < last) ? sx + 1 : last];
+        int n = yend - cy;
+
+        // Edge rows clamp to themselves; everything else is branch-free.
+        for (int k = 0; k < n; k++) {
+            int sy = cy + k;
+            int up = (sy > 0) ? sy - 1 : 0;
+            int down = (sy < last) ? sy + 1 : last;
+            float dzdx = 0.5f * H->zscale * (float)(right[sy] - left[sy]);
+            float dzdy = 0.5f * H->zscale * (float)(mid[down] - mid[up]);
+            float norm = 1.0f / sqrtf(dzdx*dzdx + dzdy*dzdy + 1.0f);
+            float lit = (-dzdx * H->light[0] - dzdy * H->light[1] + H->light[2]) * norm;
+            lit = (lit > 0.0f) ? lit : 0.0f;
+            intensity[k] = H->ambient + (1.0f - H->ambient) * lit;
+            height[k] = (float)mid[sy] / (float)T->maxh;
+            steep[k] = 1.0f - norm; // 0 when flat, approaching 1 when sheer
+        }
+
+        for (int k = 0; k < n; k++) {
+            // Base color runs from color 1 (low) to color 2 (high); slope
+            // tinting pulls steep cells back toward color 1.
+            float t = height[k] * (1.0f - H->slope_tint * steep[k]);
+            float r = (H->r1 + (H->r2 - H->r1) * t) * intensity[k];
+            float g = (H->g1 + (H->g2 - H->g1) * t) * intensity[k];
+            float b = (H->b1 + (H->b2 - H->b1) * t) * intensity[k];
+            BitmapPixel* P = &H->shade[(size_t)(cy + k) * H->cells + sx];
+            P->r = (uint8_t)(r + 0.5f);
+            P->g = (uint8_t)(g + 0.5f);
+            P->b = (uint8_t)(b + 0.5f);
+        }
+    }
+}
+
+static void hillshade_tile_par(void* arg, int i) {
+    hillshade_t* H = arg;
+    int tiles_per_row = (H->cells + HILLSHADE_TILE - 1) / HILLSHADE_TILE;
+    hillshade_tile(H, (i % tiles_per_row) * HILLSHADE_TILE,
+            (i / tiles_per_row) * HILLSHADE_TILE);
+}
+
+void DrawFn_drawspan_hillshade(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    hillshade_t* H = d->mem;
+    int ry, rx0, rx1;
+    if (!ds_clip_span(d, x, y, len, &ry, &rx0, &rx1)) return;
+    BitmapPixel* P = bmp_pixelptr(B, d->x1 + rx0, y);
+
+    // Same pixel to cell mapping as the flat diamond-square shader.
+    size_t sy = (size_t)ry * H->cells / d->x2;
+    BitmapPixel* row = &H->shade[sy * H->cells];
+    for (int i = rx0; i < rx1; i++, P++) {
+        *P = row[(size_t)i * H->cells / d->x2];
+    }
+}
+
+void DrawFn_drawpx_hillshade(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    DrawFn_drawspan_hillshade(B, d, x, y, 1);
+}
+
+void DrawFn_free_hillshade(DrawFn* d) {
+    hillshade_t* H = d->mem;
+    free_ds(H->T);
+    free(H->shade);
+    free(H);
+}
+
+// T must have been generated for max(w, h) pixels.
+static DrawFn* internal_init_hillshade(int x, int y, int w, int h, ds_t* T,
+        double azimuth, double elevation, double ambient,
+        double zfactor, double slope_tint,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    // Initialize memory
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    hillshade_t* H = malloc(sizeof(hillshade_t));
+    assert(H);
+
+    // Initialize functions
+    d->pxfn = &DrawFn_drawpx_hillshade;
+    d->spanfn = &DrawFn_drawspan_hillshade;
+    d->coverage = COVER_PAINT;
+    d->freefn = &DrawFn_free_hillshade;
+
+    // Use x1, y1 to store top left; x2 to store w & h, as for the flat shader.
+    d->x1 = x;
+    d->y1 = y;
+    d->x2 = (w > h) ? w : h;
+    d->mem = H;
+
+    H->T = T;
+    H->cells = H->T->dim - 1;
+    H->shade = malloc(sizeof(BitmapPixel) * (size_t)H->cells * H->cells);
+    assert(H->shade);
+
+    // Azimuth is clockwise from up (north); elevation is above the horizon.
+    // Both are in degrees.
+    double az = azimuth * M_PI / 180.0;
+    double el = elevation * M_PI / 180.0;
+    H->light[0] = (float)(sin(az) * cos(el));
+    H->light[1] = (float)(-cos(az) * cos(el));
+    H->light[2] = (float)sin(el);
+    H->ambient = (float)ambient;
+    H->slope_tint = (float)slope_tint;
+    H->zscale = (float)(zfactor * H->cells / H->T->maxh);
+    H->r1 = r1;
+    H->g1 = g1;
+    H->b1 = b1;
+    H->r2 = r2;
+    H->g2 = g2;
+    H->b2 = b2;
+
+    // Shade every cell.
+    int tiles_per_row = (H->cells + HILLSHADE_TILE - 1) / HILLSHADE_TILE;
+    par_for(tiles_per_row * tiles_per_row, &hillshade_tile_par, H);
+
+    return d;
+}
+
+DrawFn* DrawFn_init_hillshade(int x, int y, int w, int h,
+        double azimuth, double elevation, double ambient,
+        double zfactor, double slope_tint,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    // Run the Diamond-Square algorithm.
+    ds_t* T = new_ds((w > h) ? w : h, 1<<12, 1);
+    return internal_init_hillshade(x, y, w, h, T,
+            azimuth, elevation, ambient, zfactor, slope_tint,
+            r1, g1, b1, r2, g2, b2);
+}
+
+DrawFn* DrawFn_init_hillshade_seeded(int x, int y, int w, int h,
+        uint32_t seed, double roughness,
+        double azimuth, double elevation, double ambient,
+        double zfactor, double slope_tint,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    // Run the Diamond-Square algorithm, or fetch its result from the cache.
+    ds_t* T = new_ds_seeded((w > h) ? w : h, 1<<12, 1, seed, roughness);
+    return internal_init_hillshade(x, y, w, h, T,
+            azimuth, elevation, ambient, zfactor, slope_tint,
+            r1, g1, b1, r2, g2, b2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Multi-field diamond-square //////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Generates up to DS_LANES fields in one traversal.  Each cell holds one
+// height per lane, side by side, so the stencil for all the fields is a short
+// fixed-length loop the compiler turns into vector arithmetic, and each
+// neighbor fetch brings in every field at once.  Lanes past the last field
+// have maxh 0 and stay flat.
+//
+// Random offsets come from hashing each field's seed with the cell's index
+// rather than from a sequential generator.  That keeps the lanes independent
+// and lets the rows of each pass (which only read cells set by earlier
+// passes) be spread across threads, with the same result on any number of
+// them.
+
+#define DS_LANES 4
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DS_X86
+#endif
+
+#define DS_INLINE static inline __attribute__((always_inline))
+
+typedef struct {
+    uint16_t* heights;  // dim x dim cells of DS_LANES heights, row major
+    uint16_t* zeros;    // A row of zero heights, for neighbors off the edge
+    int dim;
+    uint32_t seed[DS_LANES];
+    int maxh[DS_LANES];
+    double roughness[DS_LANES];
+    int base[3];                // Base color, in 16.16 fixed point
+    int weight[3][DS_LANES];    // 16.16 color per unit height, by channel
+} ds_multi_t;
+
+// DS_LANES heights, as stored and as worked on.
+typedef uint16_t ds_lanes16 __attribute__((vector_size(2 * DS_LANES)));
+typedef int32_t ds_lanes __attribute__((vector_size(4 * DS_LANES)));
+typedef uint32_t ds_ulanes __attribute__((vector_size(4 * DS_LANES)));
+
+typedef struct {
+    ds_multi_t* M;
+    int step;           // Half the side of the squares being filled
+    ds_ulanes seed;
+    ds_ulanes range;    // Random offsets are on [0, range) - half
+    ds_lanes half;
+    ds_lanes maxh;
+} ds_multi_pass_t;
+
+DS_INLINE ds_lanes ds_load(const uint16_t* c) {
+    ds_lanes16 h;
+    memcpy(&h, c, sizeof(h));
+    return __builtin_convertvector(h, ds_lanes);
+}
+
+// Sets the heights at cell c to the average sum/4 of its neighbors plus a
+// random offset, for every lane.  The offset comes from a hash of the lane's
+// seed and the cell's index.
+DS_INLINE void ds_multi_set(ds_multi_pass_t* S, uint16_t* c,
+        ds_lanes sum, uint32_t index) {
+    ds_ulanes h = S->seed ^ (index * 0x9e3779b1u);
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    ds_lanes r = (ds_lanes)(((h >> 16) * S->range) >> 16) - S->half;
+
+    ds_lanes height = (sum >> 2) + r;
+    height &= ~(height < 0);
+    ds_lanes over = height > S->maxh;
+    height = (height & ~over) | (S->maxh & over);
+    ds_lanes16 out = __builtin_convertvector(height, ds_lanes16);
+    memcpy(c, &out, sizeof(out));
+}
+
+// Diamond step, for row 2t+1 (in units of the step) of the squares.
+DS_INLINE void ds_multi_diamond(ds_multi_pass_t* S, int t) {
+    ds_multi_t* M = S->M;
+    int s = S->step;
+    size_t stride = (size_t)M->dim * DS_LANES;
+    int i = s + 2 * s * t;
+    uint16_t* above = &M->heights[(i - s) * stride];
+    uint16_t* row = &M->heights[i * stride];
+    uint16_t* below = &M->heights[(i + s) * stride];
+    for (int j = s; j < M->dim; j += 2 * s) {
+        ds_lanes sum = ds_load(&above[(j - s) * DS_LANES]) +
+            ds_load(&above[(j + s) * DS_LANES]) +
+            ds_load(&below[(j - s) * DS_LANES]) +
+            ds_load(&below[(j + s) * DS_LANES]);
+        ds_multi_set(S, &row[j * DS_LANES], sum, (uint32_t)i * M->dim + j);
+    }
+}
+
+// Square step, for row t (in units of the step).  As in d_s_recurse,
+// neighbors off the edge count as 0; they are read from M->zeros.
+DS_INLINE void ds_multi_square(ds_multi_pass_t* S, int t) {
+    ds_multi_t* M = S->M;
+    int s = S->step;
+    int last = M->dim - 1;
+    size_t stride = (size_t)M->dim * DS_LANES;
+    int i = s * t;
+    uint16_t* above = (i != 0) ? &M->heights[(i - s) * stride] : M->zeros;
+    uint16_t* row = &M->heights[i * stride];
+    uint16_t* below = (i != last) ? &M->heights[(i + s) * stride] : M->zeros;
+    for (int j = (t % 2) ? 0 : s; j < M->dim; j += 2 * s) {
+        const uint16_t* left = (j != 0) ? &row[(j - s) * DS_LANES] : M->zeros;
+        const uint16_t* right = (j != last) ? &row[(j + s) * DS_LANES] : M->zeros;
+        ds_lanes sum = ds_load(left) + ds_load(right) +
+            ds_load(&above[j * DS_LANES]) + ds_load(&below[j * DS_LANES]);
+        ds_multi_set(S, &row[j * DS_LANES], sum, (uint32_t)i * M->dim + j);
+    }
+}
+
+// The steps are compiled twice: for any CPU, and for AVX2 (which has a
+// single instruction for the hash's 32-bit multiplies), picked at run time.
+static void ds_multi_diamond_row(void* arg, int t) {
+    ds_multi_diamond(arg, t);
+}
+
+static void ds_multi_square_row(void* arg, int t) {
+    ds_multi_square(arg, t);
+}
+
+#ifdef DS_X86
+__attribute__((target("avx2")))
+static void ds_multi_diamond_row_avx2(void* arg, int t) {
+    ds_multi_diamond(arg, t);
+}
+
+__attribute__((target("avx2")))
+static void ds_multi_square_row_avx2(void* arg, int t) {
+    ds_multi_square(arg, t);
+}
+#endif
+
+static size_t ds_multi_bytes(ds_multi_t* M) {
+    return sizeof(uint16_t) * DS_LANES * (size_t)M->dim * M->dim;
+}
+
+// The heights are written once each, scattered over the whole array, so at
+// this size most of the cost of the last step can go to faulting pages in.
+// Ask for huge pages where the kernel allows it.
+static uint16_t* ds_multi_alloc(ds_multi_t* M) {
+    void* p = mmap(NULL, ds_multi_bytes(M), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(p != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+    madvise(p, ds_multi_bytes(M), MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+static void ds_multi_generate(ds_multi_t* M) {
+    ds_multi_pass_t S;
+    S.M = M;
+    int mag[DS_LANES];
+    for (int k = 0; k < DS_LANES; k++) {
+        S.seed[k] = M->seed[k];
+        S.maxh[k] = M->maxh[k];
+        mag[k] = M->maxh[k] / 2;
+    }
+
+    // Corners are anywhere on [0, maxh].
+    int last = M->dim - 1;
+    size_t corners[4] = { 0, last, (size_t)last * M->dim, (size_t)last * M->dim + last };
+    S.range = (ds_ulanes)S.maxh + 1;
+    S.half = (ds_lanes){ 0 };
+    for (int c = 0; c < 4; c++) {
+        ds_multi_set(&S, &M->heights[corners[c] * DS_LANES], (ds_lanes){ 0 },
+                (uint32_t)corners[c]);
+    }
+
+    void (*diamond)(void*, int) = &ds_multi_diamond_row;
+    void (*square)(void*, int) = &ds_multi_square_row;
+#ifdef DS_X86
+    if (__builtin_cpu_supports("avx2")) {
+        diamond = &ds_multi_diamond_row_avx2;
+        square = &ds_multi_square_row_avx2;
+    }
+#endif
+    for (S.step = last / 2; S.step > 0; S.step /= 2) {
+        for (int k = 0; k < DS_LANES; k++) {
+            S.range[k] = mag[k] + 1;
+            S.half[k] = mag[k] / 2;
+            mag[k] = (int)(mag[k] * M->roughness[k]);
+        }
+        par_for(last / (2 * S.step), diamond, &S);
+        par_for(last / S.step + 1, square, &S);
+    }
+}
+
+void DrawFn_drawspan_diamondsquare_multi(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    ds_multi_t* M = d->mem;
+    int ry, rx0, rx1;
+    if (!ds_clip_span(d, x, y, len, &ry, &rx0, &rx1)) return;
+    BitmapPixel* P = bmp_pixelptr(B, d->x1 + rx0, y);
+
+    // Same pixel to cell mapping as the flat diamond-square shader.
+    size_t cy = (size_t)ry * (M->dim - 1) / d->x2;
+    const uint16_t* row = &M->heights[cy * M->dim * DS_LANES];
+    for (int i = rx0; i < rx1; i++, P++) {
+        size_t cx = (size_t)i * (M->dim - 1) / d->x2;
+        const uint16_t* h = &row[cx * DS_LANES];
+        int v[3];
+        for (int c = 0; c < 3; c++) {
+            v[c] = M->base[c];
+            for (int k = 0; k < DS_LANES; k++) {
+                v[c] += h[k] * M->weight[c][k];
+            }
+            v[c] = (v[c] >> 16 > 255) ? 255 : v[c] >> 16;
+        }
+        P->r = v[0];
+        P->g = v[1];
+        P->b = v[2];
+    }
+}
+
+void DrawFn_drawpx_diamondsquare_multi(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    DrawFn_drawspan_diamondsquare_multi(B, d, x, y, 1);
+}
+
+void DrawFn_free_diamondsquare_multi(DrawFn* d) {
+    ds_multi_t* M = d->mem;
+    munmap(M->heights, ds_multi_bytes(M));
+    free(M->zeros);
+    free(M);
+}
+
+DrawFn* DrawFn_init_diamondsquare_multi(int x, int y, int w, int h,
+        const DsField* fields, const BitmapPixel* colors, int nfields,
+        uint8_t r, uint8_t g, uint8_t b) {
+    assert(nfields > 0 && nfields <= DS_MAXFIELDS);
+    _Static_assert(DS_MAXFIELDS <= DS_LANES, "each field needs a lane");
+
+    // Initialize memory
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    ds_multi_t* M = calloc(1, sizeof(ds_multi_t));
+    assert(M);
+
+    // Initialize functions
+    d->pxfn = &DrawFn_drawpx_diamondsquare_multi;
+    d->spanfn = &DrawFn_drawspan_diamondsquare_multi;
+    d->coverage = COVER_PAINT;
+    d->freefn = &DrawFn_free_diamondsquare_multi;
+
+    // Use x1, y1 to store top left; x2 to store w & h, as for the flat shader.
+    d->x1 = x;
+    d->y1 = y;
+    d->x2 = (w > h) ? w : h;
+    d->mem = M;
+
+    // Set up the fields and their colors.
+    M->dim = ds_dim(d->x2, 1);
+    M->base[0] = r << 16;
+    M->base[1] = g << 16;
+    M->base[2] = b << 16;
+    for (int k = 0; k < nfields; k++) {
+        assert(fields[k].maxh > 0 && fields[k].maxh <= UINT16_MAX);
+        M->seed[k] = fields[k].seed;
+        M->maxh[k] = fields[k].maxh;
+        M->roughness[k] = fields[k].roughness;
+        M->weight[0][k] = (int)(colors[k].r * 65536.0 / fields[k].maxh);
+        M->weight[1][k] = (int)(colors[k].g * 65536.0 / fields[k].maxh);
+        M->weight[2][k] = (int)(colors[k].b * 65536.0 / fields[k].maxh);
+    }
+
+    // Run the Diamond-Square algorithm for all fields at once.
+    M->heights = ds_multi_alloc(M);
+    M->zeros = calloc((size_t)M->dim * DS_LANES, sizeof(uint16_t));
+    assert(M->zeros);
+    ds_multi_generate(M);
+
+    return d;
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 //// OLD CODE TO BE DELETED///////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
@@ -302,4 +1063,4 @@ DrawFn* DrawFn_init_diamondsquare(int x, int y, int w, int h,
 //    return true;
 //}
 
-#endif /* _DIAMONDSQUARE_H_ */
+#endif /* _DIAMONDSQUARE_C_ */
@@ -1,6 +1,7 @@
 #ifndef _DIAMONDSQUARE_H_
 #define _DIAMONDSQUARE_H_
 
+#include <stdint.h>
 #include "bmp.h"
 
 // Draw a diamond-square algorithm (cloud fractal) pattern.  Specify the area to
@@ -10,4 +11,71 @@ DrawFn* DrawFn_init_diamondsquare(int x, int y, int w, int h,
         uint8_t r1, uint8_t g1, uint8_t b1,
         uint8_t r2, uint8_t g2, uint8_t b2);
 
+// As DrawFn_init_diamondsquare, but reproducible: the pattern depends only on
+// seed, roughness and the size of the area.  roughness scales the random
+// offsets from one step to the next (0.5 is the classic algorithm; lower is
+// smoother).
+DrawFn* DrawFn_init_diamondsquare_seeded(int x, int y, int w, int h,
+        uint32_t seed, double roughness,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2);
+
+// Keep seeded heightmaps in an on-disk cache in directory dir (created if
+// needed), so that later runs with the same parameters map the stored heights
+// in rather than regenerating them.  Least recently used entries are evicted
+// once the cache exceeds max_bytes.  Pass NULL to disable the cache.
+void ds_cache_configure(const char* dir, uint64_t max_bytes);
+
+// Draw diamond-square terrain lit by a distant sun.  Area is specified as for
+// DrawFn_init_diamondsquare.
+//
+// * azimuth is the sun's direction in degrees clockwise from up, elevation its
+//   angle in degrees above the horizon.
+// * ambient (on [0, 1]) is the light level of surfaces facing away from the
+//   sun.
+// * zfactor is vertical exaggeration; at 1.0 the highest peak is as tall as
+//   the area is wide.
+// * Colors blend from (r1, g1, b1) at the lowest elevations to (r2, g2, b2) at
+//   the highest.  slope_tint (on [0, 1]) pulls steep slopes back toward the
+//   low color; use 0 to color by elevation alone.
+DrawFn* DrawFn_init_hillshade(int x, int y, int w, int h,
+        double azimuth, double elevation, double ambient,
+        double zfactor, double slope_tint,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2);
+
+// As DrawFn_init_hillshade, but the terrain is reproducible from seed and
+// roughness (see DrawFn_init_diamondsquare_seeded) and goes through the
+// heightmap cache, so the same terrain can be shaded again cheaply.
+DrawFn* DrawFn_init_hillshade_seeded(int x, int y, int w, int h,
+        uint32_t seed, double roughness,
+        double azimuth, double elevation, double ambient,
+        double zfactor, double slope_tint,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2);
+
+// Most fields DrawFn_init_diamondsquare_multi generates at once.
+#define DS_MAXFIELDS 4
+
+// One field of a multi-field diamond-square: its seed, roughness (as for
+// DrawFn_init_diamondsquare_seeded) and maximum height (at most 65535).
+typedef struct {
+    uint32_t seed;
+    double roughness;
+    int maxh;
+} DsField;
+
+// Draw several diamond-square fields, generated together in one pass, mixed
+// into one image.  Area is specified as for DrawFn_init_diamondsquare.
+//
+// * Each pixel is (r, g, b) plus, for each of the nfields fields, colors[k]
+//   scaled by the field's height over its maxh, clamped to 255.  Give each
+//   field its own channel for independent channels, or mix freely.
+// * Up to DS_MAXFIELDS fields cost little more than one.  Patterns are
+//   reproducible from the fields' parameters and the size of the area, but
+//   differ from DrawFn_init_diamondsquare_seeded's.
+DrawFn* DrawFn_init_diamondsquare_multi(int x, int y, int w, int h,
+        const DsField* fields, const BitmapPixel* colors, int nfields,
+        uint8_t r, uint8_t g, uint8_t b);
+
 #endif /* _DIAMONDSQUARE_H_ */
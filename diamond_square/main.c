@@ -19,9 +19,55 @@ int main(int argc, char* argv[]) {
     // Write diamond-square pattern to image
     bmp_drawrect(B, 0, 0, width, height, ds);
 
-    // Write image and clean up
+    // Write image
     bmp_write("ds.bmp", B);
     DrawFn_free(ds);
+
+    // Run diamond-square again, this time lit as terrain from the northwest.
+    // The terrain is seeded and cached, so later runs (and the second
+    // rendering below) map the heights in instead of generating them.
+    ds_cache_configure("ds_cache", 256 << 20);
+    DrawFn* hs = DrawFn_init_hillshade_seeded(0, 0, width, height,
+            1234, 0.5,
+            315.0, 45.0, 0.2, 1.0, 0.5,
+            40, 90, 40,
+            235, 225, 200);
+    bmp_drawrect(B, 0, 0, width, height, hs);
+
+    // Write image
+    bmp_write("hillshade.bmp", B);
+    DrawFn_free(hs);
+
+    // The same terrain under a low evening sun from the west
+    hs = DrawFn_init_hillshade_seeded(0, 0, width, height,
+            1234, 0.5,
+            270.0, 25.0, 0.3, 1.0, 0.0,
+            60, 30, 60,
+            250, 170, 90);
+    bmp_drawrect(B, 0, 0, width, height, hs);
+    bmp_write("hillshade_dusk.bmp", B);
+    DrawFn_free(hs);
+    ds_cache_configure(NULL, 0);
+
+    // Colored clouds: three fields generated together, one per channel
+    uint32_t seed = (uint32_t)rand();
+    DsField fields[] = {
+        { seed,     0.50, 4096 },
+        { seed + 1, 0.55, 4096 },
+        { seed + 2, 0.60, 4096 },
+    };
+    BitmapPixel colors[] = {
+        { .r = 224, .g = 48,  .b = 32  },
+        { .r = 32,  .g = 160, .b = 96  },
+        { .r = 48,  .g = 64,  .b = 224 },
+    };
+    DrawFn* rgb = DrawFn_init_diamondsquare_multi(0, 0, width, height,
+            fields, colors, 3, 8, 8, 16);
+    bmp_drawrect(B, 0, 0, width, height, rgb);
+
+    // Write image and clean up
+    bmp_write("ds_rgb.bmp", B);
+    DrawFn_free(rgb);
     bmp_free(B);
     return 0;
 }
@@ -0,0 +1,372 @@
+//
+// Escape-time fractals.  Each point is iterated under z -> z^2 + c until |z|
+// passes a bailout radius; the number of iterations that took, corrected by
+// how far past the radius it landed, gives a smoothly varying value to color
+// the point by.  Points that never escape are in the set.
+//
+// Points are iterated several at a time in SIMD registers: four with AVX2, two
+// with SSE2 (always present on x86-64), or one at a time elsewhere.  The AVX2
+// path is chosen at run time if the CPU has it; define ESCAPE_SCALAR to force
+// the plain C version.  Two shortcuts spare most of the work inside the set:
+// the main cardioid and period-2 bulb of the Mandelbrot set are detected in
+// closed form, and orbits that return to an earlier point (to within
+// ESCAPE_PERIOD_EPS) are cycles, so inside.
+//
+// (https://en.wikipedia.org/wiki/Plotting_algorithms_for_the_Mandelbrot_set)
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "bmp.h"
+#include "parallel.h"
+#include "escape.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(ESCAPE_SCALAR)
+#include <immintrin.h>
+#define ESCAPE_X86
+#endif
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+
+#define ESCAPE_BAILOUT2 65536.0     // Squared bailout radius; large for
+                                    // smoother coloring
+#define ESCAPE_PERIOD_EPS 1e-12
+#define ESCAPE_PERIOD_START 8       // Iteration of the first orbit snapshot
+#define ESCAPE_MAXCOLORS 64
+#define ESCAPE_LUT 1024             // Palette entries per color cycle
+
+typedef struct {
+    int w, h;
+    double x0, y0;      // Point on the plane at the center of pixel (0, 0)
+    double step;        // Pixel size on the plane
+    int julia;
+    double jr, ji;
+    int maxiter;
+    float* mu;          // Smooth escape time per pixel; -1 inside the set
+    BitmapPixel lut[ESCAPE_LUT];
+    double lut_scale;   // LUT entries per iteration
+    BitmapPixel inside;
+} escape_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Iteration ///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Whether c is in the main cardioid or the period-2 bulb of the Mandelbrot set.
+static inline int escape_in_bulbs(double cr, double ci) {
+    double xr = cr - 0.25;
+    double q = xr * xr + ci * ci;
+    if (q * (q + xr) <= 0.25 * ci * ci) return 1;
+    return (cr + 1.0) * (cr + 1.0) + ci * ci <= 0.0625;
+}
+
+// Smooth escape time from the iteration n at which |z|^2 reached m, or -1 if
+// the point never escaped.
+static inline float escape_smooth(double n, double m) {
+    if (n < 0) return -1.0f;
+    double mu = n + 1.0 - log2(0.5 * log(m));
+    return (float)MAX(mu, 0.0);
+}
+
+// Whether the lane at pixel (i, j) starts out known to be inside.
+static inline int escape_skip(escape_t* E, int i, double cr, double ci) {
+    return i >= E->w || (!E->julia && escape_in_bulbs(cr, ci));
+}
+
+#ifndef ESCAPE_X86
+
+static void escape_row_scalar(escape_t* E, int j, float* out) {
+    double ci_row = E->y0 + j * E->step;
+    for (int i = 0; i < E->w; i++) {
+        double pr = E->x0 + i * E->step;
+        if (escape_skip(E, i, pr, ci_row)) {
+            out[i] = -1.0f;
+            continue;
+        }
+        double zr = E->julia ? pr : 0.0, zi = E->julia ? ci_row : 0.0;
+        double cr = E->julia ? E->jr : pr, ci = E->julia ? E->ji : ci_row;
+        double sr = zr, si = zi;
+        double n = -1.0, m = 0.0;
+        int check = ESCAPE_PERIOD_START;
+        for (int it = 0; it < E->maxiter; it++) {
+            double zr2 = zr * zr, zi2 = zi * zi;
+            if (zr2 + zi2 > ESCAPE_BAILOUT2) {
+                n = it;
+                m = zr2 + zi2;
+                break;
+            }
+            zi = (zr + zr) * zi + ci;
+            zr = zr2 - zi2 + cr;
+            if (it == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            } else if (fabs(zr - sr) < ESCAPE_PERIOD_EPS &&
+                    fabs(zi - si) < ESCAPE_PERIOD_EPS) {
+                break;
+            }
+        }
+        out[i] = escape_smooth(n, m);
+    }
+}
+
+#else
+
+static void escape_row_sse2(escape_t* E, int j, float* out) {
+    const __m128d b2 = _mm_set1_pd(ESCAPE_BAILOUT2);
+    const __m128d eps = _mm_set1_pd(ESCAPE_PERIOD_EPS);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    double ci_row = E->y0 + j * E->step;
+
+    for (int i = 0; i < E->w; i += 2) {
+        double px[2];
+        int64_t live[2];
+        for (int k = 0; k < 2; k++) {
+            px[k] = E->x0 + (i + k) * E->step;
+            live[k] = escape_skip(E, i + k, px[k], ci_row) ? 0 : -1;
+        }
+        __m128d active = _mm_loadu_pd((double*)live);
+        if (!_mm_movemask_pd(active)) {
+            for (int k = 0; k < 2 && i + k < E->w; k++) out[i + k] = -1.0f;
+            continue;
+        }
+
+        __m128d pr = _mm_loadu_pd(px), pi = _mm_set1_pd(ci_row);
+        __m128d zr = E->julia ? pr : _mm_setzero_pd();
+        __m128d zi = E->julia ? pi : _mm_setzero_pd();
+        __m128d cr = E->julia ? _mm_set1_pd(E->jr) : pr;
+        __m128d ci = E->julia ? _mm_set1_pd(E->ji) : pi;
+        __m128d sr = zr, si = zi;
+        __m128d n = _mm_set1_pd(-1.0), m = _mm_setzero_pd();
+        int check = ESCAPE_PERIOD_START;
+
+        for (int it = 0; it < E->maxiter; it++) {
+            __m128d zr2 = _mm_mul_pd(zr, zr), zi2 = _mm_mul_pd(zi, zi);
+            __m128d mag = _mm_add_pd(zr2, zi2);
+            __m128d esc = _mm_and_pd(active, _mm_cmpgt_pd(mag, b2));
+            if (_mm_movemask_pd(esc)) {
+                n = _mm_or_pd(_mm_and_pd(esc, _mm_set1_pd(it)), _mm_andnot_pd(esc, n));
+                m = _mm_or_pd(_mm_and_pd(esc, mag), _mm_andnot_pd(esc, m));
+                active = _mm_andnot_pd(esc, active);
+            }
+            if (!_mm_movemask_pd(active)) break;
+
+            zi = _mm_add_pd(_mm_mul_pd(_mm_add_pd(zr, zr), zi), ci);
+            zr = _mm_add_pd(_mm_sub_pd(zr2, zi2), cr);
+            if (it == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            } else {
+                __m128d dr = _mm_andnot_pd(sign, _mm_sub_pd(zr, sr));
+                __m128d di = _mm_andnot_pd(sign, _mm_sub_pd(zi, si));
+                __m128d same = _mm_and_pd(_mm_cmplt_pd(dr, eps), _mm_cmplt_pd(di, eps));
+                active = _mm_andnot_pd(same, active);
+            }
+        }
+
+        double nv[2], mv[2];
+        _mm_storeu_pd(nv, n);
+        _mm_storeu_pd(mv, m);
+        for (int k = 0; k < 2 && i + k < E->w; k++) {
+            out[i + k] = escape_smooth(nv[k], mv[k]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void escape_row_avx2(escape_t* E, int j, float* out) {
+    const __m256d b2 = _mm256_set1_pd(ESCAPE_BAILOUT2);
+    const __m256d eps = _mm256_set1_pd(ESCAPE_PERIOD_EPS);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    double ci_row = E->y0 + j * E->step;
+
+    for (int i = 0; i < E->w; i += 4) {
+        double px[4];
+        int64_t live[4];
+        for (int k = 0; k < 4; k++) {
+            px[k] = E->x0 + (i + k) * E->step;
+            live[k] = escape_skip(E, i + k, px[k], ci_row) ? 0 : -1;
+        }
+        __m256d active = _mm256_loadu_pd((double*)live);
+        if (!_mm256_movemask_pd(active)) {
+            for (int k = 0; k < 4 && i + k < E->w; k++) out[i + k] = -1.0f;
+            continue;
+        }
+
+        __m256d pr = _mm256_loadu_pd(px), pi = _mm256_set1_pd(ci_row);
+        __m256d zr = E->julia ? pr : _mm256_setzero_pd();
+        __m256d zi = E->julia ? pi : _mm256_setzero_pd();
+        __m256d cr = E->julia ? _mm256_set1_pd(E->jr) : pr;
+        __m256d ci = E->julia ? _mm256_set1_pd(E->ji) : pi;
+        __m256d sr = zr, si = zi;
+        __m256d n = _mm256_set1_pd(-1.0), m = _mm256_setzero_pd();
+        int check = ESCAPE_PERIOD_START;
+
+        for (int it = 0; it < E->maxiter; it++) {
+            __m256d zr2 = _mm256_mul_pd(zr, zr), zi2 = _mm256_mul_pd(zi, zi);
+            __m256d mag = _mm256_add_pd(zr2, zi2);
+            __m256d esc = _mm256_and_pd(active, _mm256_cmp_pd(mag, b2, _CMP_GT_OQ));
+            if (_mm256_movemask_pd(esc)) {
+                n = _mm256_blendv_pd(n, _mm256_set1_pd(it), esc);
+                m = _mm256_blendv_pd(m, mag, esc);
+                active = _mm256_andnot_pd(esc, active);
+            }
+            if (!_mm256_movemask_pd(active)) break;
+
+            zi = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(zr, zr), zi), ci);
+            zr = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), cr);
+            if (it == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            } else {
+                __m256d dr = _mm256_andnot_pd(sign, _mm256_sub_pd(zr, sr));
+                __m256d di = _mm256_andnot_pd(sign, _mm256_sub_pd(zi, si));
+                __m256d same = _mm256_and_pd(_mm256_cmp_pd(dr, eps, _CMP_LT_OQ),
+                        _mm256_cmp_pd(di, eps, _CMP_LT_OQ));
+                active = _mm256_andnot_pd(same, active);
+            }
+        }
+
+        double nv[4], mv[4];
+        _mm256_storeu_pd(nv, n);
+        _mm256_storeu_pd(mv, m);
+        for (int k = 0; k < 4 && i + k < E->w; k++) {
+            out[i + k] = escape_smooth(nv[k], mv[k]);
+        }
+    }
+}
+
+#endif /* ESCAPE_X86 */
+
+// One row per index, so par_for hands out rows as threads come free.
+static void escape_row(void* arg, int j) {
+    escape_t* E = arg;
+    float* out = &E->mu[(size_t)j * E->w];
+#ifdef ESCAPE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        escape_row_avx2(E, j, out);
+    } else {
+        escape_row_sse2(E, j, out);
+    }
+#else
+    escape_row_scalar(E, j, out);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Drawing /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+void DrawFn_drawspan_escape(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    escape_t* E = d->mem;
+
+    // Clip the span to the area.
+    int ry = (int)y - d->y1;
+    if (ry < 0 || ry >= E->h) return;
+    int rx0 = MAX((int)x - d->x1, 0);
+    int rx1 = MIN((int)(x + len) - d->x1, E->w);
+    if (rx0 >= rx1) return;
+
+    BitmapPixel* P = bmp_pixelptr(B, d->x1 + rx0, y);
+    const float* mu = &E->mu[(size_t)ry * E->w];
+    for (int i = rx0; i < rx1; i++, P++) {
+        if (mu[i] < 0.0f) {
+            *P = E->inside;
+        } else {
+            *P = E->lut[(unsigned int)(mu[i] * E->lut_scale) % ESCAPE_LUT];
+        }
+    }
+}
+
+void DrawFn_drawpx_escape(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    DrawFn_drawspan_escape(B, d, x, y, 1);
+}
+
+void DrawFn_free_escape(DrawFn* d) {
+    escape_t* E = d->mem;
+    free(E->mu);
+    free(E);
+}
+
+static DrawFn* internal_init_escape(int x, int y, int w, int h,
+        double cx, double cy, double span, int julia, double jr, double ji,
+        int maxiter, const BitmapPixel* palette, int ncolors, double cycle,
+        uint8_t r, uint8_t g, uint8_t b) {
+    assert(w > 0 && h > 0);
+    assert(span > 0.0 && cycle > 0.0);
+    assert(maxiter > 0);
+    assert(ncolors > 0 && ncolors <= ESCAPE_MAXCOLORS);
+
+    // Initialize memory
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    escape_t* E = malloc(sizeof(escape_t));
+    assert(E);
+    E->mu = malloc(sizeof(float) * (size_t)w * h);
+    assert(E->mu);
+
+    // Set up the view and palette.
+    E->w = w;
+    E->h = h;
+    E->step = span / w;
+    E->x0 = cx - (w - 1) * E->step / 2;
+    E->y0 = cy - (h - 1) * E->step / 2;
+    E->julia = julia;
+    E->jr = jr;
+    E->ji = ji;
+    E->maxiter = maxiter;
+    E->lut_scale = ESCAPE_LUT / cycle;
+    E->inside.r = r;
+    E->inside.g = g;
+    E->inside.b = b;
+    for (int k = 0; k < ESCAPE_LUT; k++) {
+        double t = (double)k * ncolors / ESCAPE_LUT;
+        int c = (int)t;
+        double f = t - c;
+        const BitmapPixel* p = &palette[c];
+        const BitmapPixel* q = &palette[(c + 1) % ncolors];
+        E->lut[k].r = (uint8_t)(p->r + (q->r - p->r) * f + 0.5);
+        E->lut[k].g = (uint8_t)(p->g + (q->g - p->g) * f + 0.5);
+        E->lut[k].b = (uint8_t)(p->b + (q->b - p->b) * f + 0.5);
+    }
+
+    // Iterate every point.
+    par_for(h, &escape_row, E);
+
+    // Initialize functions
+    d->pxfn = &DrawFn_drawpx_escape;
+    d->spanfn = &DrawFn_drawspan_escape;
+    d->coverage = COVER_PAINT;
+    d->freefn = &DrawFn_free_escape;
+
+    // Initialize other members.  Use x1, y1 to store the top left of the area.
+    d->mem = E;
+    d->x1 = x;
+    d->y1 = y;
+    return d;
+}
+
+DrawFn* DrawFn_init_mandelbrot(int x, int y, int w, int h,
+        double cx, double cy, double span, int maxiter,
+        const BitmapPixel* palette, int ncolors, double cycle,
+        uint8_t r, uint8_t g, uint8_t b) {
+    return internal_init_escape(x, y, w, h, cx, cy, span, 0, 0.0, 0.0,
+            maxiter, palette, ncolors, cycle, r, g, b);
+}
+
+DrawFn* DrawFn_init_julia(int x, int y, int w, int h,
+        double cx, double cy, double span, double jr, double ji, int maxiter,
+        const BitmapPixel* palette, int ncolors, double cycle,
+        uint8_t r, uint8_t g, uint8_t b) {
+    return internal_init_escape(x, y, w, h, cx, cy, span, 1, jr, ji,
+            maxiter, palette, ncolors, cycle, r, g, b);
+}
@@ -0,0 +1,28 @@
+#ifndef _ESCAPE_H_
+#define _ESCAPE_H_
+
+#include <stdint.h>
+#include "bmp.h"
+
+// Draw the Mandelbrot set over the w x h area at (x, y).  The iteration is run
+// for the whole area up front, spread over par_nthreads() threads.
+//
+// * (cx, cy) is the point of the complex plane at the center of the area, and
+//   span is the width of the area on the plane.
+// * Points still bounded after maxiter iterations are taken to be in the set,
+//   and are drawn in (r, g, b).
+// * Other points are colored smoothly by escape time, cycling through the
+//   ncolors colors of palette once every cycle iterations.
+DrawFn* DrawFn_init_mandelbrot(int x, int y, int w, int h,
+        double cx, double cy, double span, int maxiter,
+        const BitmapPixel* palette, int ncolors, double cycle,
+        uint8_t r, uint8_t g, uint8_t b);
+
+// As DrawFn_init_mandelbrot, but draws the filled Julia set for the constant
+// (jr, ji).
+DrawFn* DrawFn_init_julia(int x, int y, int w, int h,
+        double cx, double cy, double span, double jr, double ji, int maxiter,
+        const BitmapPixel* palette, int ncolors, double cycle,
+        uint8_t r, uint8_t g, uint8_t b);
+
+#endif /* _ESCAPE_H_ */
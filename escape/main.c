@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "bmp.h"
+#include "escape.h"
+
+int main(int argc, char* argv[]) {
+    // Set up
+    int width = 1920;
+    int height = 1080;
+    BitmapImage* B = bmp_create(width, height);
+    BitmapPixel palette[] = {
+        { .r = 0,   .g = 7,   .b = 100 },
+        { .r = 32,  .g = 107, .b = 203 },
+        { .r = 237, .g = 255, .b = 255 },
+        { .r = 255, .g = 170, .b = 0   },
+        { .r = 0,   .g = 2,   .b = 0   },
+    };
+
+    // The whole Mandelbrot set on the left, and a Julia set on the right
+    DrawFn* mandelbrot = DrawFn_init_mandelbrot(0, 0, width/2, height,
+            -0.75, 0.0, 3.0, 1000, palette, 5, 64.0, 0, 0, 0);
+    DrawFn* julia = DrawFn_init_julia(width/2, 0, width/2, height,
+            0.0, 0.0, 3.2, -0.8, 0.156, 1000, palette, 5, 64.0, 0, 0, 0);
+
+    // Write fractals to image
+    bmp_drawrect(B, 0, 0, width/2, height, mandelbrot);
+    bmp_drawrect(B, width/2, 0, width/2, height, julia);
+
+    // Write image and clean up
+    bmp_write("escape.bmp", B);
+    DrawFn_free(mandelbrot);
+    DrawFn_free(julia);
+    bmp_free(B);
+    return 0;
+}
@@ -0,0 +1,307 @@
+//
+// Iterated function systems drawn by the chaos game.  Starting from any point,
+// repeatedly apply one of the system's affine maps, chosen at random with the
+// map's probability; after a few steps the point stays on the attractor, and
+// the density of the points it visits is the fractal's invariant measure.
+//
+// Each thread plays its own game into its own histogram, so the inner loop
+// shares nothing; the histograms are summed and tone mapped at the end.
+//
+// (https://en.wikipedia.org/wiki/Iterated_function_system)
+// (https://en.wikipedia.org/wiki/Chaos_game)
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "bmp.h"
+#include "parallel.h"
+#include "ifs.h"
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+
+#define IFS_MAXMAPS 64
+#define IFS_WARMUP 64               // Steps before a point is on the attractor
+#define IFS_BOUNDS_POINTS 100000    // Points used to find the attractor's extent
+#define IFS_BAND 16                 // Rows per task when merging histograms
+
+const IfsMap ifs_sierpinski[3] = {
+    { 0.5, 0.0, 0.0, 0.5, 0.0,  0.0, 1.0 },
+    { 0.5, 0.0, 0.0, 0.5, 0.5,  0.0, 1.0 },
+    { 0.5, 0.0, 0.0, 0.5, 0.25, 0.5, 1.0 },
+};
+
+const IfsMap ifs_fern[4] = {
+    {  0.00,  0.00,  0.00, 0.16, 0.0, 0.00, 0.01 },
+    {  0.85,  0.04, -0.04, 0.85, 0.0, 1.60, 0.85 },
+    {  0.20, -0.26,  0.23, 0.22, 0.0, 1.60, 0.07 },
+    { -0.15,  0.28,  0.26, 0.24, 0.0, 0.44, 0.07 },
+};
+
+typedef struct {
+    IfsMap maps[IFS_MAXMAPS];
+    int nmaps;
+
+    // Alias table for choosing maps: slot i is picked uniformly, then keeps i
+    // if the low 32 random bits are under threshold[i], else takes alias[i].
+    uint64_t threshold[IFS_MAXMAPS];
+    int alias[IFS_MAXMAPS];
+
+    double scale, offx, offy;   // Pixel = point * scale + offset
+    int w, h;
+    uint64_t points;
+    uint64_t seed;
+    int nchunks;
+    uint32_t** hist;            // One w x h histogram per chunk
+    uint32_t* maxhits;          // Per band of IFS_BAND rows
+    uint8_t* tone;              // Tone mapped density, w x h
+    double gamma;
+} ifs_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Chaos game //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t ifs_splitmix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// xorshift64*
+static inline uint64_t ifs_rand(uint64_t* s) {
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static inline const IfsMap* ifs_choose(ifs_t* I, uint64_t* s) {
+    uint64_t r = ifs_rand(s);
+    int i = (int)(((r >> 32) * (uint64_t)I->nmaps) >> 32);
+    return &I->maps[((r & 0xffffffffULL) < I->threshold[i]) ? i : I->alias[i]];
+}
+
+static inline void ifs_step(const IfsMap* m, double* x, double* y) {
+    double nx = m->a * *x + m->b * *y + m->e;
+    *y = m->c * *x + m->d * *y + m->f;
+    *x = nx;
+}
+
+// Builds the alias table (Vose's method).
+static void ifs_build_alias(ifs_t* I) {
+    int n = I->nmaps;
+    double total = 0.0;
+    for (int i = 0; i < n; i++) total += I->maps[i].p;
+    assert(total > 0.0);
+
+    double q[IFS_MAXMAPS];
+    int small[IFS_MAXMAPS], large[IFS_MAXMAPS];
+    int ns = 0, nl = 0;
+    for (int i = 0; i < n; i++) {
+        q[i] = I->maps[i].p * n / total;
+        I->alias[i] = i;
+        if (q[i] < 1.0) small[ns++] = i;
+        else large[nl++] = i;
+    }
+    while (ns && nl) {
+        int s = small[--ns], l = large[nl - 1];
+        I->alias[s] = l;
+        I->threshold[s] = (uint64_t)(q[s] * 4294967296.0);
+        q[l] -= 1.0 - q[s];
+        if (q[l] < 1.0) {
+            nl--;
+            small[ns++] = l;
+        }
+    }
+    // Whatever is left is 1 up to rounding.
+    while (nl) I->threshold[large[--nl]] = 1ULL << 32;
+    while (ns) I->threshold[small[--ns]] = 1ULL << 32;
+}
+
+// Finds the attractor's extent from a short serial run, and fits it to the
+// w x h area.
+static void ifs_fit(ifs_t* I) {
+    uint64_t s = ifs_splitmix(I->seed) | 1;
+    double x = 0.0, y = 0.0;
+    for (int k = 0; k < IFS_WARMUP; k++) ifs_step(ifs_choose(I, &s), &x, &y);
+
+    double xmin = x, xmax = x, ymin = y, ymax = y;
+    for (int k = 0; k < IFS_BOUNDS_POINTS; k++) {
+        ifs_step(ifs_choose(I, &s), &x, &y);
+        xmin = MIN(xmin, x);
+        xmax = MAX(xmax, x);
+        ymin = MIN(ymin, y);
+        ymax = MAX(ymax, y);
+    }
+
+    // Leave a small margin for points the short run missed.
+    double xspan = xmax - xmin, yspan = ymax - ymin;
+    double pad = 0.01 * MAX(xspan, yspan);
+    xmin -= pad;
+    ymin -= pad;
+    xspan += 2 * pad;
+    yspan += 2 * pad;
+    if (xspan <= 0.0) xspan = 1.0;
+    if (yspan <= 0.0) yspan = 1.0;
+
+    I->scale = MIN(I->w / xspan, I->h / yspan);
+    I->offx = (I->w - xspan * I->scale) / 2 - xmin * I->scale;
+    I->offy = (I->h - yspan * I->scale) / 2 - ymin * I->scale;
+}
+
+static void ifs_play(void* arg, int c) {
+    ifs_t* I = arg;
+    uint32_t* H = calloc((size_t)I->w * I->h, sizeof(uint32_t));
+    assert(H);
+    I->hist[c] = H;
+
+    uint64_t n = I->points / I->nchunks + ((uint64_t)c < I->points % I->nchunks);
+    uint64_t s = ifs_splitmix(I->seed + 1 + c) | 1;
+    double x = 0.0, y = 0.0;
+    for (int k = 0; k < IFS_WARMUP; k++) ifs_step(ifs_choose(I, &s), &x, &y);
+
+    double scale = I->scale, offx = I->offx, offy = I->offy;
+    double w = I->w, h = I->h;
+    for (uint64_t k = 0; k < n; k++) {
+        ifs_step(ifs_choose(I, &s), &x, &y);
+        double px = x * scale + offx;
+        double py = y * scale + offy;
+        if (px >= 0.0 && px < w && py >= 0.0 && py < h) {
+            // Saturate: a dense pixel can take more than 2^32 hits.
+            uint32_t* hits = &H[(size_t)py * I->w + (size_t)px];
+            *hits += (*hits != UINT32_MAX);
+        }
+    }
+}
+
+// Sums a band of rows of every histogram into the first one, saturating.
+static void ifs_merge(void* arg, int band) {
+    ifs_t* I = arg;
+    size_t start = (size_t)band * IFS_BAND * I->w;
+    size_t end = MIN((size_t)(band + 1) * IFS_BAND, (size_t)I->h) * I->w;
+    uint32_t* H = I->hist[0];
+    uint32_t maxhits = 0;
+    for (size_t i = start; i < end; i++) {
+        uint64_t total = H[i];
+        for (int c = 1; c < I->nchunks; c++) total += I->hist[c][i];
+        H[i] = (uint32_t)MIN(total, UINT32_MAX);
+        maxhits = MAX(maxhits, H[i]);
+    }
+    I->maxhits[band] = maxhits;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Drawing /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+void DrawFn_drawspan_ifs(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    ifs_t* I = d->mem;
+
+    // Clip the span to the area.
+    int ry = (int)y - d->y1;
+    if (ry < 0 || ry >= I->h) return;
+    int rx0 = MAX((int)x - d->x1, 0);
+    int rx1 = MIN((int)(x + len) - d->x1, I->w);
+    if (rx0 >= rx1) return;
+
+    BitmapPixel* P = bmp_pixelptr(B, d->x1 + rx0, y);
+    const uint8_t* T = &I->tone[(size_t)ry * I->w];
+    int rdiff = (int)d->r2 - (int)d->r1;
+    int gdiff = (int)d->g2 - (int)d->g1;
+    int bdiff = (int)d->b2 - (int)d->b1;
+    for (int i = rx0; i < rx1; i++, P++) {
+        int t = T[i];
+        P->r = (uint8_t)(d->r1 + rdiff * t / 255);
+        P->g = (uint8_t)(d->g1 + gdiff * t / 255);
+        P->b = (uint8_t)(d->b1 + bdiff * t / 255);
+    }
+}
+
+void DrawFn_drawpx_ifs(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    DrawFn_drawspan_ifs(B, d, x, y, 1);
+}
+
+void DrawFn_free_ifs(DrawFn* d) {
+    ifs_t* I = d->mem;
+    free(I->tone);
+    free(I);
+}
+
+DrawFn* DrawFn_init_ifs(int x, int y, int w, int h,
+        const IfsMap* maps, int nmaps, uint64_t points, double gamma,
+        uint32_t seed,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    assert(w > 0 && h > 0);
+    assert(nmaps > 0 && nmaps <= IFS_MAXMAPS);
+    assert(gamma > 0.0);
+
+    // Initialize memory
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    ifs_t* I = calloc(1, sizeof(ifs_t));
+    assert(I);
+    memcpy(I->maps, maps, sizeof(IfsMap) * nmaps);
+    I->nmaps = nmaps;
+    I->w = w;
+    I->h = h;
+    I->points = points;
+    I->seed = seed;
+    I->gamma = gamma;
+    ifs_build_alias(I);
+    ifs_fit(I);
+
+    // Play the chaos game, one histogram per thread, then merge.
+    I->nchunks = par_nthreads();
+    I->hist = calloc(I->nchunks, sizeof(uint32_t*));
+    int nbands = (h + IFS_BAND - 1) / IFS_BAND;
+    I->maxhits = malloc(sizeof(uint32_t) * nbands);
+    assert(I->hist && I->maxhits);
+    par_for(I->nchunks, &ifs_play, I);
+    par_for(nbands, &ifs_merge, I);
+    for (int c = 1; c < I->nchunks; c++) free(I->hist[c]);
+
+    // Tone map: log density, then gamma.
+    uint32_t maxhits = 0;
+    for (int b = 0; b < nbands; b++) maxhits = MAX(maxhits, I->maxhits[b]);
+    I->tone = malloc((size_t)w * h);
+    assert(I->tone);
+    uint32_t* H = I->hist[0];
+    double norm = (maxhits > 0) ? 1.0 / log1p(maxhits) : 0.0;
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        I->tone[i] = H[i] ? (uint8_t)(255.0 * pow(log1p(H[i]) * norm, 1.0 / gamma) + 0.5) : 0;
+    }
+    free(H);
+    free(I->hist);
+    free(I->maxhits);
+    I->hist = NULL;
+    I->maxhits = NULL;
+
+    // Initialize functions
+    d->pxfn = &DrawFn_drawpx_ifs;
+    d->spanfn = &DrawFn_drawspan_ifs;
+    d->coverage = COVER_PAINT;
+    d->freefn = &DrawFn_free_ifs;
+
+    // Initialize other members.  Use x1, y1 to store the top left of the area.
+    d->mem = I;
+    d->x1 = x;
+    d->y1 = y;
+    d->r1 = r1;
+    d->g1 = g1;
+    d->b1 = b1;
+    d->r2 = r2;
+    d->g2 = g2;
+    d->b2 = b2;
+    return d;
+}
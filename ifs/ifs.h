@@ -0,0 +1,35 @@
+#ifndef _IFS_H_
+#define _IFS_H_
+
+#include <stdint.h>
+#include "bmp.h"
+
+// One affine map of an iterated function system, taking (x, y) to
+// (a*x + b*y + e, c*x + d*y + f).  p is the relative probability of the chaos
+// game choosing it.
+typedef struct {
+    double a, b, c, d, e, f;
+    double p;
+} IfsMap;
+
+// Some classic systems.
+extern const IfsMap ifs_sierpinski[3];
+extern const IfsMap ifs_fern[4];
+
+// Draw the attractor of an iterated function system by the chaos game.  The
+// attractor is scaled to fit the w x h area at (x, y), keeping its aspect
+// ratio; pixels outside the area are left alone.
+//
+// * points is the total number of points plotted (billions are fine).  They
+//   are spread over par_nthreads() threads, each with its own histogram.
+// * Density is tone mapped by log(1 + hits) / log(1 + max hits), raised to
+//   1/gamma.  Larger gamma brings out sparse regions.
+// * Colors blend from (r1, g1, b1) where no points land to (r2, g2, b2) at
+//   the densest pixel.
+DrawFn* DrawFn_init_ifs(int x, int y, int w, int h,
+        const IfsMap* maps, int nmaps, uint64_t points, double gamma,
+        uint32_t seed,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2);
+
+#endif /* _IFS_H_ */
@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "bmp.h"
+#include "ifs.h"
+
+int main(int argc, char* argv[]) {
+    // Set up
+    int width = 1080;
+    int height = 1080;
+    BitmapImage* B = bmp_create(width, height);
+
+    // Barnsley's fern, from 200 million points
+    DrawFn* fern = DrawFn_init_ifs(0, 0, width, height,
+            ifs_fern, 4, 200000000, 2.2, (uint32_t)clock(),
+            8, 16, 8,
+            160, 255, 96);
+
+    // Write fractal to image
+    bmp_drawrect(B, 0, 0, width, height, fern);
+
+    // Write image and clean up
+    bmp_write("ifs.bmp", B);
+    DrawFn_free(fern);
+    bmp_free(B);
+    return 0;
+}
@@ -28,7 +28,7 @@ static int internal_pt_on_line(
         int x2, int y2,
         int x) {
     // * If x1=x2, returns y1.
-    // * Will suffer from numerical issues from massive ints.
+    // * Intermediate products are 64-bit, so any int coordinates work.
     
     // Check bounds
     if (x1 == x2) {
@@ -41,23 +41,31 @@ static int internal_pt_on_line(
         SWAP(y1, y2);
     }
 
-    int ret = x - x1;
-    ret *= y2 - y1;
-    ret /= x2 - x1;
+    int64_t ret = (int64_t)x - x1;
+    ret *= (int64_t)y2 - y1;
+    ret /= (int64_t)x2 - x1;
     ret += y1;
 
-    return ret;
+    return (int)ret;
+}
+
+static inline int internal_ifloor(double f) {
+    int i = (int)f;
+    return i - (f < i);
+}
+
+static inline int internal_iceil(double f) {
+    int i = (int)f;
+    return i + (f > i);
 }
 
 static inline void internal_getrgbpixel(BitmapImage* B,
         unsigned int x, unsigned int y, BitmapPixel* px) {
-    assert(x >= 0);
-    assert(y >= 0);
-    assert(x < B->width);
-    assert(y < B->height);
+    x -= B->x0;
+    y -= B->y0;
 
-    unsigned int pixel_offset = ROWWIDTH(B->width) * y;
-    pixel_offset += x * sizeof(BitmapPixel);
+    size_t pixel_offset = (size_t)ROWWIDTH(B->width) * y;
+    pixel_offset += (size_t)x * sizeof(BitmapPixel);
     BitmapPixel* P = PTR_BYTE_ADD(B->raw, pixel_offset);
     px->r = P->r;
     px->g = P->g;
@@ -67,13 +75,11 @@ static inline void internal_getrgbpixel(BitmapImage* B,
 static inline void internal_drawrgbpixel(BitmapImage* B,
         unsigned int x, unsigned int y,
         uint8_t r, uint8_t g, uint8_t b) {
-    assert(x >= 0);
-    assert(y >= 0);
-    assert(x < B->width);
-    assert(y < B->height);
+    x -= B->x0;
+    y -= B->y0;
 
-    unsigned int pixel_offset = ROWWIDTH(B->width) * y;
-    pixel_offset += x * sizeof(BitmapPixel);
+    size_t pixel_offset = (size_t)ROWWIDTH(B->width) * y;
+    pixel_offset += (size_t)x * sizeof(BitmapPixel);
     BitmapPixel* P = PTR_BYTE_ADD(B->raw, pixel_offset);
     P->r = r;
     P->g = g;
@@ -87,7 +93,18 @@ static inline void internal_drawrgbpixel(BitmapImage* B,
 //
 // (BitmapImage*, DrawFn*, unsigned int x, unsigned int y)
 
+//
+// Drawing functions may optionally supply a span function, which draws a
+// horizontal run of pixels in one call:
+//
+// (BitmapImage*, DrawFn*, unsigned int x, unsigned int y, unsigned int len)
+//
+// Primitives hand whole spans to it so that shaders can evaluate a row in
+// blocks rather than paying a function call per pixel.
+
 typedef void (*DrawFn_px)(BitmapImage*, DrawFn*, unsigned int, unsigned int);
+typedef void (*DrawFn_span)(BitmapImage*, DrawFn*,
+        unsigned int, unsigned int, unsigned int);
 typedef void (*DrawFn_del)(DrawFn*);
 
 static inline void internal_drawpx(BitmapImage* B, DrawFn* d,
@@ -95,6 +112,27 @@ static inline void internal_drawpx(BitmapImage* B, DrawFn* d,
     (*(DrawFn_px)(d->pxfn))(B, d, x, y);
 }
 
+// Marks len pixels from (x, y) as covered, per d->coverage, on images with an
+// alpha plane.
+static inline void internal_markspan(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    if (!B->alpha || d->coverage == COVER_NONE) return;
+    size_t offset = (size_t)(y - B->y0) * B->width + (x - B->x0);
+    memset(&B->alpha[offset], (d->coverage == COVER_ERASE) ? 0 : 255, len);
+}
+
+static inline void internal_drawspan(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    internal_markspan(B, d, x, y, len);
+    if (d->spanfn) {
+        (*(DrawFn_span)(d->spanfn))(B, d, x, y, len);
+        return;
+    }
+    for (unsigned int i = 0; i < len; i++) {
+        internal_drawpx(B, d, x+i, y);
+    }
+}
+
 void DrawFn_free(DrawFn* d) {
     if (d->freefn) {
         (*(DrawFn_del)(d->freefn))(d);
@@ -119,6 +157,23 @@ DrawFn* DrawFn_init_invert() {
     assert(d);
     d->pxfn = &DrawFn_drawpx_invert;
     d->freefn = NULL;
+    d->spanfn = NULL;
+    d->coverage = COVER_PAINT;
+    return d;
+}
+
+void DrawFn_drawpx_erase(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    // Only the alpha plane changes (see internal_markspan).
+}
+
+DrawFn* DrawFn_init_erase() {
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    d->pxfn = &DrawFn_drawpx_erase;
+    d->freefn = NULL;
+    d->spanfn = NULL;
+    d->coverage = COVER_ERASE;
     return d;
 }
 
@@ -129,6 +184,8 @@ DrawFn* DrawFn_init_none() {
     assert(d);
     d->pxfn = &DrawFn_drawpx_noop;
     d->freefn = NULL;
+    d->spanfn = NULL;
+    d->coverage = COVER_NONE;
     return d;
 }
 
@@ -142,6 +199,8 @@ DrawFn* DrawFn_init_rgb(uint8_t r, uint8_t g, uint8_t b) {
     assert(d);
     d->pxfn = &DrawFn_drawpx_rgb;
     d->freefn = NULL;
+    d->spanfn = NULL;
+    d->coverage = COVER_PAINT;
     d->r1 = r;
     d->g1 = g;
     d->b1 = b;
@@ -192,6 +251,8 @@ DrawFn* DrawFn_init_axialgradient(int x1, int y1, int x2, int y2, int x3, int y3
     // Initialize members
     d->pxfn = &DrawFn_drawpx_axialgradient;
     d->freefn = NULL;
+    d->spanfn = NULL;
+    d->coverage = COVER_PAINT;
     d->x1 = x1;
     d->x2 = x2;
     d->x3 = x3;
@@ -213,45 +274,31 @@ DrawFn* DrawFn_init_axialgradient(int x1, int y1, int x2, int y2, int x3, int y3
 ////////////////////////////////////////////////////////////////////////////////
 
 void bmp_drawrect(BitmapImage* B, 
-        unsigned int x, unsigned int y,
-        unsigned int w, unsigned int h,
+        int x, int y,
+        int w, int h,
         DrawFn* d) {
-    // Check bounds
-    assert(x >= 0);
-    assert(y >= 0);
-    assert(x+w <= B->width);
-    assert(y+h <= B->height);
+    // Clip once; the spans below are then inside the image.
+    BitmapRect R;
+    bmp_getclip(B, &R);
+    int64_t x1 = MIN((int64_t)x + w, R.x1), y1 = MIN((int64_t)y + h, R.y1);
+    x = MAX(x, R.x0);
+    y = MAX(y, R.y0);
+    if (x >= x1 || y >= y1) return;
 
     // Scan across image
-    for (unsigned int j = 0; j < h; j++) {
-        for (unsigned int i = 0; i < w; i++) {
-            internal_drawpx(B, d, x+i, y+j);
-        }
+    for (int j = y; j < y1; j++) {
+        internal_drawspan(B, d, x, j, x1 - x);
     }
 }
 
 void bmp_drawtriangle(BitmapImage* B,
-        unsigned int x1, unsigned int y1,
-        unsigned int x2, unsigned int y2,
-        unsigned int x3, unsigned int y3,
+        int x1, int y1,
+        int x2, int y2,
+        int x3, int y3,
         DrawFn* d) {
     // Borrowing the below algorithm:
     // https://www.gabrielgambetta.com/computer-graphics-from-scratch/07-filled-triangles.html
 
-    // Check bounds
-    //
-    // This could be optimized, but it's nice to see exactly what's wrong.
-    assert(x3 >= 0);
-    assert(y1 >= 0);
-    assert(y2 >= 0);
-    assert(y3 >= 0);
-    assert(x1 < B->width);
-    assert(x2 < B->width);
-    assert(x3 < B->width);
-    assert(y1 < B->height);
-    assert(y2 < B->height);
-    assert(y3 < B->height);
-
     // Sort points such that y1 <= y2 <= y3
     if (y1 > y2) {
         SWAP(y1, y2);
@@ -264,20 +311,428 @@ void bmp_drawtriangle(BitmapImage* B,
         SWAP(x2, x3);
     }
 
+    // Clip rows once, then each span's ends.
+    BitmapRect R;
+    bmp_getclip(B, &R);
+    int ystart = MAX(y1, R.y0);
+    int yend = MIN(y3, R.y1 - 1);
+
     // For each horizontal line in the triangle, fill from left to right.
-    for (unsigned int y = y1; y <= y3; y++) {
+    for (int y = ystart; y <= yend; y++) {
         // xl is the "long" side (1 to 3), xs is the other side.
-        unsigned int xl = internal_pt_on_line(y1, x1, y3, x3, y);
-        unsigned int xs = 0;
+        int xl = internal_pt_on_line(y1, x1, y3, x3, y);
+        int xs = 0;
         if (y > y2) { // on (2, 3)
             xs = internal_pt_on_line(y2, x2, y3, x3, y);
         } else { // on (1, 2)
             xs = internal_pt_on_line(y1, x1, y2, x2, y);
         }
-        int xright = MAX(xl, xs);
-        int xleft  = MIN(xl, xs);
-        for (int x = xleft; x <= xright; x++) {
-            internal_drawpx(B, d, x, y);
+        int xright = MIN(MAX(xl, xs), R.x1 - 1);
+        int xleft  = MAX(MIN(xl, xs), R.x0);
+        if (xleft > xright) continue;
+        internal_drawspan(B, d, xleft, y, xright - xleft + 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Polygons ////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scanline fill.  Row j samples the line y = j + 0.5 through the pixel
+// centers.  Edges are sorted by the first row they cross into an edge table;
+// as rows advance, edges move from it into the active edge list, their
+// crossings step along by their inverse slope, and they drop out after their
+// last row.  Walking the active edges in order of crossing, with a winding
+// count, gives the runs of inside pixels directly.
+
+typedef struct {
+    int jstart, jend;   // Rows [jstart, jend) the edge crosses
+    double x;           // Crossing with the current row
+    double dxdy;
+    int winding;        // +1 if the edge runs down, -1 if up
+} internal_edge;
+
+static int internal_edge_cmp(const void* a, const void* b) {
+    const internal_edge* e = a;
+    const internal_edge* f = b;
+    return (e->jstart > f->jstart) - (e->jstart < f->jstart);
+}
+
+// Sort edges by first row.  When the rows they start on are dense enough,
+// this buckets them by row; otherwise it falls back on qsort.
+static void internal_sort_edges(internal_edge* edges, int n) {
+    if (n < 2) return;
+    int jmin = INT_MAX, jmax = INT_MIN;
+    for (int i = 0; i < n; i++) {
+        jmin = MIN(jmin, edges[i].jstart);
+        jmax = MAX(jmax, edges[i].jstart);
+    }
+    int64_t range = (int64_t)jmax - jmin + 1;
+    if (range > 4 * (int64_t)n) {
+        qsort(edges, n, sizeof(internal_edge), &internal_edge_cmp);
+        return;
+    }
+
+    int* start = calloc(range + 1, sizeof(int));
+    internal_edge* sorted = malloc(sizeof(internal_edge) * n);
+    assert(start && sorted);
+    for (int i = 0; i < n; i++) {
+        start[edges[i].jstart - jmin + 1]++;
+    }
+    for (int64_t j = 0; j < range; j++) {
+        start[j + 1] += start[j];
+    }
+    for (int i = 0; i < n; i++) {
+        sorted[start[edges[i].jstart - jmin]++] = edges[i];
+    }
+    memcpy(edges, sorted, sizeof(internal_edge) * n);
+    free(sorted);
+    free(start);
+}
+
+// Sort n active edges by crossing, using tmp (room for n) as scratch.
+static void internal_sort_active(internal_edge** a, internal_edge** tmp, int n) {
+    if (n <= 16) {
+        for (int i = 1; i < n; i++) {
+            internal_edge* e = a[i];
+            int k = i;
+            for (; k > 0 && a[k - 1]->x > e->x; k--) {
+                a[k] = a[k - 1];
+            }
+            a[k] = e;
         }
+        return;
+    }
+    int h = n / 2;
+    internal_sort_active(a, tmp, h);
+    internal_sort_active(a + h, tmp, n - h);
+    int i = 0, j = h;
+    for (int k = 0; k < n; k++) {
+        tmp[k] = (j == n || (i < h && a[i]->x <= a[j]->x)) ? a[i++] : a[j++];
+    }
+    memcpy(a, tmp, sizeof(internal_edge*) * n);
+}
+
+void bmp_drawpolygons(BitmapImage* B, const BitmapPoint* points,
+        const int* counts, int ncontours, DrawFn* d, FillRule rule) {
+    int n = 0;
+    for (int c = 0; c < ncontours; c++) {
+        n += counts[c];
     }
+    if (n < 3) return;
+    BitmapRect R;
+    bmp_getclip(B, &R);
+
+    // Build the edge table, leaving out edges that cross no rows.
+    internal_edge* edges = malloc(sizeof(internal_edge) * n);
+    internal_edge** active = malloc(sizeof(internal_edge*) * n);
+    internal_edge** spare = malloc(sizeof(internal_edge*) * n);
+    assert(edges && active && spare);
+    int nedges = 0;
+    int first = 0;
+    for (int c = 0; c < ncontours; c++) {
+        for (int i = 0; i < counts[c]; i++) {
+            BitmapPoint p = points[first + i];
+            BitmapPoint q = points[first + (i + 1) % counts[c]];
+            int winding = 1;
+            if (p.y > q.y) {
+                SWAP(p, q);
+                winding = -1;
+            }
+            double top = MAX(p.y - 0.5, (double)R.y0);
+            double bottom = MIN(q.y - 0.5, (double)R.y1);
+            internal_edge* e = &edges[nedges];
+            e->jstart = internal_iceil(top);
+            e->jend = internal_iceil(bottom);
+            if (e->jstart >= e->jend) continue;
+            e->dxdy = (q.x - p.x) / (q.y - p.y);
+            e->x = p.x + (e->jstart + 0.5 - p.y) * e->dxdy;
+            e->winding = winding;
+            nedges++;
+        }
+        first += counts[c];
+    }
+    internal_sort_edges(edges, nedges);
+
+    int nactive = 0, next = 0;
+    int j = (nedges > 0) ? MAX(edges[0].jstart, R.y0) : R.y1;
+    for (; j < R.y1 && (next < nedges || nactive > 0); j++) {
+        if (nactive == 0) j = edges[next].jstart;
+
+        // Drop finished edges and step the others to this row.
+        int m = 0;
+        for (int i = 0; i < nactive; i++) {
+            if (active[i]->jend <= j) continue;
+            active[i]->x += active[i]->dxdy;
+            active[m++] = active[i];
+        }
+        nactive = m;
+
+        // Keep the list in order of crossing.  It is usually nearly sorted
+        // from the last row, so insertion sort is quick, but many short edges
+        // can shuffle it; past a few moves per edge, sort it outright.
+        long moves = 0;
+        for (int i = 1; i < nactive; i++) {
+            internal_edge* e = active[i];
+            int k = i;
+            for (; k > 0 && active[k - 1]->x > e->x; k--) {
+                active[k] = active[k - 1];
+            }
+            active[k] = e;
+            moves += i - k;
+            if (moves > 4L * nactive) {
+                internal_sort_active(active, spare, nactive);
+                break;
+            }
+        }
+
+        // Sort the edges starting on this row on their own (there may be
+        // many, in any order) and merge them in.
+        for (; next < nedges && edges[next].jstart <= j; next++) {
+            internal_edge* e = &edges[next];
+            if (e->jend <= j) continue;
+            e->x += (j - e->jstart) * e->dxdy;
+            e->jstart = j;
+            active[nactive++] = e;
+        }
+        if (nactive > m) {
+            internal_sort_active(&active[m], spare, nactive - m);
+            int a = 0, b = m;
+            for (int i = 0; i < nactive; i++) {
+                if (b == nactive || (a < m && active[a]->x <= active[b]->x)) {
+                    spare[i] = active[a++];
+                } else {
+                    spare[i] = active[b++];
+                }
+            }
+            SWAP(active, spare);
+        }
+
+        // Fill the runs between crossings where the point is inside.
+        int count = 0;
+        for (int i = 0; i + 1 < nactive; i++) {
+            count += (rule == FILL_EVENODD) ? 1 : active[i]->winding;
+            int inside = (rule == FILL_EVENODD) ? (count & 1) : (count != 0);
+            if (!inside) continue;
+
+            // Merge with following runs that are also inside.
+            double xa = active[i]->x;
+            while (i + 2 < nactive) {
+                int c = count + ((rule == FILL_EVENODD) ? 1 : active[i + 1]->winding);
+                if ((rule == FILL_EVENODD) ? (c & 1) : (c != 0)) {
+                    count = c;
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            double xb = active[i + 1]->x;
+            int xstart = internal_iceil(MAX(xa - 0.5, (double)R.x0));
+            int xend = internal_iceil(MIN(xb - 0.5, (double)R.x1));
+            if (xstart < xend) {
+                internal_drawspan(B, d, xstart, j, xend - xstart);
+            }
+        }
+    }
+
+    free(spare);
+    free(active);
+    free(edges);
+}
+
+void bmp_drawpolygon(BitmapImage* B, const BitmapPoint* points, int n,
+        DrawFn* d, FillRule rule) {
+    bmp_drawpolygons(B, points, &n, 1, d, rule);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Anti-aliased drawing ////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Shapes are given in continuous coordinates, where pixel (i, j) covers the
+// square [i, i+1] x [j, j+1].  Each row of the shape is split into pixels it
+// covers completely, which go to the shader as one span, and pixels on its
+// edges.  Edge pixels get their exact covered area by clipping the shape to
+// the pixel, and the shader's output is blended over the old pixel by that
+// coverage.  Only convex shapes are handled here.
+
+#define AA_MAXPTS 16
+
+typedef struct {
+    double x, y;
+} internal_pt;
+
+// Clips convex polygon in (n points) to the half-plane where
+// sign * (axis coordinate) >= sign * bound.  Writes to out and returns the new
+// point count.
+static int internal_clip_convex(const internal_pt* in, int n, internal_pt* out,
+        int axis_y, double bound, double sign) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        const internal_pt* a = &in[i];
+        const internal_pt* b = &in[(i + 1) % n];
+        double da = sign * ((axis_y ? a->y : a->x) - bound);
+        double db = sign * ((axis_y ? b->y : b->x) - bound);
+        if (da >= 0) {
+            out[m++] = *a;
+        }
+        if ((da >= 0) != (db >= 0)) {
+            double t = da / (da - db);
+            out[m].x = a->x + t * (b->x - a->x);
+            out[m].y = a->y + t * (b->y - a->y);
+            m++;
+        }
+    }
+    assert(m <= AA_MAXPTS);
+    return m;
+}
+
+static double internal_area(const internal_pt* p, int n) {
+    double a = 0.0;
+    for (int i = 0; i < n; i++) {
+        const internal_pt* q = &p[(i + 1) % n];
+        a += p[i].x * q->y - q->x * p[i].y;
+    }
+    return (a < 0) ? -a / 2 : a / 2;
+}
+
+// Finds where the horizontal line at y crosses a convex polygon.  Returns 0 if
+// it misses.
+static int internal_chord(const internal_pt* p, int n, double y,
+        double* left, double* right) {
+    int hit = 0;
+    for (int i = 0; i < n; i++) {
+        const internal_pt* a = &p[i];
+        const internal_pt* b = &p[(i + 1) % n];
+        if ((y < a->y && y < b->y) || (y > a->y && y > b->y)) continue;
+        double x = (a->y == b->y) ? a->x :
+            a->x + (y - a->y) * (b->x - a->x) / (b->y - a->y);
+        double x2 = (a->y == b->y) ? b->x : x;
+        if (!hit) {
+            *left = MIN(x, x2);
+            *right = MAX(x, x2);
+            hit = 1;
+        } else {
+            *left = MIN(*left, MIN(x, x2));
+            *right = MAX(*right, MAX(x, x2));
+        }
+    }
+    return hit;
+}
+
+// Draws one pixel of the shader blended over the existing pixel by coverage.
+static void internal_drawpx_coverage(BitmapImage* B, DrawFn* d,
+        int x, int y, double coverage) {
+    int a = (int)(coverage * 255.0 + 0.5);
+    if (a <= 0) return;
+    if (a >= 255) {
+        internal_drawspan(B, d, x, y, 1);
+        return;
+    }
+
+    BitmapPixel before, after;
+    internal_getrgbpixel(B, x, y, &before);
+    internal_drawpx(B, d, x, y);
+    internal_getrgbpixel(B, x, y, &after);
+    if (!B->alpha) {
+        internal_drawrgbpixel(B, x, y,
+                before.r + (((int)after.r - before.r) * a + 127) / 255,
+                before.g + (((int)after.g - before.g) * a + 127) / 255,
+                before.b + (((int)after.b - before.b) * a + 127) / 255);
+        return;
+    }
+    if (d->coverage == COVER_NONE) return;
+
+    // On layers, composite over the old pixel (straight alpha) instead, so
+    // edges over transparent pixels don't pick up its color.
+    uint8_t* A = &B->alpha[(size_t)(y - B->y0) * B->width + (x - B->x0)];
+    if (d->coverage == COVER_ERASE) {
+        *A = (*A * (255 - a) + 127) / 255;
+        return;
+    }
+    int old = *A * (255 - a);               // Old weight, times 255
+    int total = a * 255 + old;              // New alpha, times 255
+    internal_drawrgbpixel(B, x, y,
+            (after.r * a * 255 + before.r * old + total / 2) / total,
+            (after.g * a * 255 + before.g * old + total / 2) / total,
+            (after.b * a * 255 + before.b * old + total / 2) / total);
+    *A = (total + 127) / 255;
+}
+
+static void internal_fill_convex_aa(BitmapImage* B, const internal_pt* p, int n,
+        DrawFn* d) {
+    assert(n >= 3 && n <= AA_MAXPTS / 2);
+
+    // Rows touched, clipped.
+    double ymin = p[0].y, ymax = p[0].y;
+    for (int i = 1; i < n; i++) {
+        ymin = MIN(ymin, p[i].y);
+        ymax = MAX(ymax, p[i].y);
+    }
+    BitmapRect R;
+    bmp_getclip(B, &R);
+    int jstart = internal_ifloor(MAX(ymin, (double)R.y0));
+    int jend = internal_iceil(MIN(ymax, (double)R.y1));
+
+    internal_pt tmp[AA_MAXPTS], row[AA_MAXPTS], px[AA_MAXPTS];
+    for (int j = jstart; j < jend; j++) {
+        // Clip the shape to this row.
+        int m = internal_clip_convex(p, n, tmp, 1, j, 1.0);
+        m = internal_clip_convex(tmp, m, row, 1, j + 1, -1.0);
+        if (m < 3) continue;
+        double xa = row[0].x, xb = row[0].x;
+        for (int i = 1; i < m; i++) {
+            xa = MIN(xa, row[i].x);
+            xb = MAX(xb, row[i].x);
+        }
+        int istart = internal_ifloor(MAX(xa, (double)R.x0));
+        int iend = internal_iceil(MIN(xb, (double)R.x1));
+
+        // A pixel is fully covered iff all four of its corners are inside,
+        // since the shape is convex.
+        int full_start = iend, full_end = iend;
+        double lt, rt, lb, rb;
+        if (internal_chord(p, n, j, &lt, &rt) &&
+                internal_chord(p, n, j + 1, &lb, &rb)) {
+            int fs = MAX(internal_iceil(MAX(lt, lb)), istart);
+            int fe = MIN(internal_ifloor(MIN(rt, rb)), iend);
+            if (fs < fe) {
+                full_start = fs;
+                full_end = fe;
+            }
+        }
+
+        // Left edge, interior, right edge.
+        for (int i = istart; i < full_start; i++) {
+            int k = internal_clip_convex(row, m, tmp, 0, i, 1.0);
+            k = internal_clip_convex(tmp, k, px, 0, i + 1, -1.0);
+            if (k >= 3) internal_drawpx_coverage(B, d, i, j, internal_area(px, k));
+        }
+        if (full_start < full_end) {
+            internal_drawspan(B, d, full_start, j, full_end - full_start);
+        }
+        for (int i = full_end; i < iend; i++) {
+            int k = internal_clip_convex(row, m, tmp, 0, i, 1.0);
+            k = internal_clip_convex(tmp, k, px, 0, i + 1, -1.0);
+            if (k >= 3) internal_drawpx_coverage(B, d, i, j, internal_area(px, k));
+        }
+    }
+}
+
+void bmp_drawtriangle_aa(BitmapImage* B,
+        double x1, double y1,
+        double x2, double y2,
+        double x3, double y3,
+        DrawFn* d) {
+    internal_pt p[3] = { { x1, y1 }, { x2, y2 }, { x3, y3 } };
+    internal_fill_convex_aa(B, p, 3, d);
+}
+
+void bmp_drawrect_aa(BitmapImage* B,
+        double x, double y,
+        double w, double h,
+        DrawFn* d) {
+    if (w <= 0 || h <= 0) return;
+    internal_pt p[4] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h } };
+    internal_fill_convex_aa(B, p, 4, d);
 }
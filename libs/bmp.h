@@ -8,9 +8,20 @@
 // Drawing functions ///////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
+// What drawing does to the coverage (alpha) plane of a layer: paint marks
+// pixels opaque, none leaves them alone, and erase makes them transparent.
+typedef enum {
+    COVER_PAINT,
+    COVER_NONE,
+    COVER_ERASE
+} DrawFnCoverage;
+
 typedef struct {
     void* pxfn;
     void* freefn;
+    void* spanfn;   // Optional; draws len pixels starting at (x, y) at once
+    DrawFnCoverage coverage;    // Set by the init function, as for pxfn
+
     uint8_t r1, g1, b1, r2, g2, b2;
     int x1, y1, x2, y2, x3, y3;
     void* mem;
@@ -28,6 +39,10 @@ DrawFn* DrawFn_init_invert();
 // Does nothing
 DrawFn* DrawFn_init_none();
 
+// Makes pixels transparent again on layers (see layer.h); does nothing on
+// other bitmaps.
+DrawFn* DrawFn_init_erase();
+
 // Draws a gradient between two axes (x1, y1) to (x2, y2) and a line with
 // the same slope through (x3, y3).  Behavior may be strange if not between the
 // two lines.
@@ -39,19 +54,64 @@ DrawFn* DrawFn_init_axialgradient(
 ////////////////////////////////////////////////////////////////////////////////
 // Write to a bitmap ///////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
-// All of these functions do some error checking via assert.
+// Shapes may extend past the edges of the image, or be entirely off it.  Each
+// is clipped once against the current clip rectangle (see bmp_pushclip), and
+// the shader is only ever called on pixels inside it.
 
 // Draw a rectangle (specified by top left, width, and height)
 void bmp_drawrect(BitmapImage* B, 
-        unsigned int x, unsigned int y,
-        unsigned int w, unsigned int h,
+        int x, int y,
+        int w, int h,
         DrawFn* d);
 
 // Draw a triangle (specified by vertices)
 void bmp_drawtriangle(BitmapImage* B,
-        unsigned int x1, unsigned int y1,
-        unsigned int x2, unsigned int y2,
-        unsigned int x3, unsigned int y3,
+        int x1, int y1,
+        int x2, int y2,
+        int x3, int y3,
+        DrawFn* d);
+
+// A point in continuous coordinates, where pixel (i, j) covers the square
+// [i, i+1] x [j, j+1].
+typedef struct {
+    double x, y;
+} BitmapPoint;
+
+// Which points of a self-intersecting polygon are inside it.  Under the
+// even-odd rule, a point is inside if a ray from it crosses the outline an odd
+// number of times; under nonzero, if the outline winds around it at all.
+typedef enum {
+    FILL_EVENODD,
+    FILL_NONZERO
+} FillRule;
+
+// Draw a polygon (specified by its n vertices, in order), which may be
+// concave or cross itself.  A pixel is drawn if its center is inside.  Each
+// row is drawn as one span per run of inside pixels, so pixels are never
+// drawn twice.
+void bmp_drawpolygon(BitmapImage* B, const BitmapPoint* points, int n,
+        DrawFn* d, FillRule rule);
+
+// Draw several polygons as one shape: counts[i] gives the number of points in
+// the ith outline, and the outlines' points follow each other in points.
+// Where outlines overlap, the fill rule counts crossings of all of them, so
+// holes can be cut by nesting outlines.
+void bmp_drawpolygons(BitmapImage* B, const BitmapPoint* points,
+        const int* counts, int ncontours, DrawFn* d, FillRule rule);
+
+// Anti-aliased versions of bmp_drawrect and bmp_drawtriangle.  Coordinates are
+// continuous, as for polygons, so (0, 0, w, h) is exactly the rect of w by h
+// pixels.  Pixels on the edges are blended by how much of them the shape
+// covers.
+void bmp_drawrect_aa(BitmapImage* B,
+        double x, double y,
+        double w, double h,
+        DrawFn* d);
+
+void bmp_drawtriangle_aa(BitmapImage* B,
+        double x1, double y1,
+        double x2, double y2,
+        double x3, double y3,
         DrawFn* d);
 
 #endif /* _BMP_H_ */
@@ -12,6 +12,8 @@
 // Every C file needs some idiosyntratic #defines
 #define PAD_TO(size, align) ((((((size)-1) / align)+1) * align))
 #define PTR_BYTE_ADD(p, x) ((void*)(((char*)(p))+(x)))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
 #define SWAP(a, b) { typeof(a) tmp = a; a = b; b = tmp; }
 #define ROWWIDTH(width) (PAD_TO((width)*sizeof(BitmapPixel), 4))
 
@@ -23,16 +25,46 @@ _Static_assert(sizeof(BitmapImageHeader) == 14);
 _Static_assert(sizeof(BitmapDIBHeader) == 40);
 _Static_assert(sizeof(BitmapPixel) == 3);
 
-BitmapImage* bmp_create(int width, int height) {
+size_t bmp_headers(BitmapImageHeader* imghdr, BitmapDIBHeader* dibhdr,
+        int width, int height) {
     // Calculate size
-    unsigned int raw_row_width = ROWWIDTH(width);
-    unsigned int raw_data_size = raw_row_width * height;
-    unsigned int size = 0;
+    size_t raw_row_width = ROWWIDTH(width);
+    size_t raw_data_size = raw_row_width * height;
+    size_t size = 0;
     size += sizeof(BitmapImageHeader);
     size += sizeof(BitmapDIBHeader);
     size += raw_data_size;
-    
+
+    // Set up the image header.  Sizes saturate for files the format can't
+    // describe (over 4GB).
+    imghdr->sig[0] = 0x42;
+    imghdr->sig[1] = 0x4d;
+    imghdr->size = (size > UINT32_MAX) ? UINT32_MAX : size;
+    imghdr->reserved[0] = 0;
+    imghdr->reserved[1] = 0;
+    imghdr->offset = sizeof(BitmapImageHeader) + sizeof(BitmapDIBHeader);
+
+    // Set up the DIB header.
+    dibhdr->header_size = sizeof(BitmapDIBHeader);
+    dibhdr->width = width;
+    dibhdr->height = height;
+    dibhdr->plane_count = 1;
+    dibhdr->bits_per_pixel = sizeof(BitmapPixel) * 8;
+    dibhdr->compression = 0; // no compression
+    dibhdr->data_size = (raw_data_size > UINT32_MAX) ? UINT32_MAX : raw_data_size;
+    dibhdr->pixels_per_meter_horiz = 2835; // 72 dpi
+    dibhdr->pixels_per_meter_vert = 2835; // 72 dpi
+    dibhdr->color_count = 0;
+    dibhdr->important_color_count = 0;
+
+    return size;
+}
+
+BitmapImage* bmp_create(int width, int height) {
     // Set up the struct.
+    BitmapImageHeader imghdr;
+    BitmapDIBHeader dibhdr;
+    size_t size = bmp_headers(&imghdr, &dibhdr, width, height);
     BitmapImage* B = calloc(sizeof(BitmapImage), 1);
     B->width = width;
     B->height = height;
@@ -41,55 +73,44 @@ BitmapImage* bmp_create(int width, int height) {
     B->imghdr = (BitmapImageHeader*)(B->img);
     B->dibhdr = (BitmapDIBHeader*)PTR_BYTE_ADD((B->img), sizeof(BitmapImageHeader));
     B->raw = (BitmapPixel*)PTR_BYTE_ADD((B->img), sizeof(BitmapImageHeader) + sizeof(BitmapDIBHeader));
-
-    // Set up the image header.
-    B->imghdr->sig[0] = 0x42;
-    B->imghdr->sig[1] = 0x4d;
-    B->imghdr->size = size;
-    B->imghdr->reserved[0] = 0;
-    B->imghdr->reserved[1] = 0;
-    B->imghdr->offset = sizeof(BitmapImageHeader) + sizeof(BitmapDIBHeader);
-
-    // Set up the DIB header.
-    B->dibhdr->header_size = sizeof(BitmapDIBHeader);
-    B->dibhdr->width = width;
-    B->dibhdr->height = height;
-    B->dibhdr->plane_count = 1;
-    B->dibhdr->bits_per_pixel = sizeof(BitmapPixel) * 8;
-    B->dibhdr->compression = 0; // no compression
-    B->dibhdr->data_size = raw_data_size;
-    B->dibhdr->pixels_per_meter_horiz = 2835; // 72 dpi
-    B->dibhdr->pixels_per_meter_vert = 2835; // 72 dpi
-    B->dibhdr->color_count = 0;
-    B->dibhdr->important_color_count = 0;
+    *B->imghdr = imghdr;
+    *B->dibhdr = dibhdr;
 
     // Color the background black.
-    memset(B->raw, 0, raw_data_size);
+    memset(B->raw, 0, size - imghdr.offset);
 
     return B;
 }
 
+void bmp_write_all(int fd, const void* buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        assert(n > 0);
+        buf = PTR_BYTE_ADD(buf, n);
+        len -= n;
+    }
+}
+
 void bmp_write(const char* filename, BitmapImage* B) {
-    int fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IROTH);
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IROTH);
     assert(fd >= 0);
-    assert(write(fd, B->img, B->imgsize) == B->imgsize);
+    bmp_write_all(fd, B->img, B->imgsize);
     assert(close(fd) == 0);
 }
 
 void bmp_free(BitmapImage* B) {
+    free(B->alpha);
     free(B->img);
     free(B);
 }
 
 static inline void internal_getrgbpixel(BitmapImage* B,
         unsigned int x, unsigned int y, BitmapPixel* px) {
-    assert(x >= 0);
-    assert(y >= 0);
-    assert(x < B->width);
-    assert(y < B->height);
+    x -= B->x0;
+    y -= B->y0;
 
-    unsigned int pixel_offset = ROWWIDTH(B->width) * y;
-    pixel_offset += x * sizeof(BitmapPixel);
+    size_t pixel_offset = (size_t)ROWWIDTH(B->width) * y;
+    pixel_offset += (size_t)x * sizeof(BitmapPixel);
     BitmapPixel* P = PTR_BYTE_ADD(B->raw, pixel_offset);
     px->r = P->r;
     px->g = P->g;
@@ -99,13 +120,11 @@ static inline void internal_getrgbpixel(BitmapImage* B,
 static inline void internal_drawrgbpixel(BitmapImage* B,
         unsigned int x, unsigned int y,
         uint8_t r, uint8_t g, uint8_t b) {
-    assert(x >= 0);
-    assert(y >= 0);
-    assert(x < B->width);
-    assert(y < B->height);
+    x -= B->x0;
+    y -= B->y0;
 
-    unsigned int pixel_offset = ROWWIDTH(B->width) * y;
-    pixel_offset += x * sizeof(BitmapPixel);
+    size_t pixel_offset = (size_t)ROWWIDTH(B->width) * y;
+    pixel_offset += (size_t)x * sizeof(BitmapPixel);
     BitmapPixel* P = PTR_BYTE_ADD(B->raw, pixel_offset);
     P->r = r;
     P->g = g;
@@ -116,3 +135,49 @@ void bmp_drawrgbpixel(BitmapImage* B, unsigned int x, unsigned int y,
         uint8_t r, uint8_t g, uint8_t b) {
     internal_drawrgbpixel(B, x, y, r, g, b);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Clipping ////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+void bmp_getclip(BitmapImage* B, BitmapRect* R) {
+    if (B->clip_depth > 0) {
+        *R = B->clip[B->clip_depth - 1];
+        return;
+    }
+    R->x0 = (int)B->x0;
+    R->y0 = (int)B->y0;
+    R->x1 = (int)MIN((int64_t)B->x0 + B->width, INT_MAX);
+    R->y1 = (int)MIN((int64_t)B->y0 + B->height, INT_MAX);
+}
+
+void bmp_pushclip(BitmapImage* B, int x, int y, int w, int h) {
+    assert(B->clip_depth < BMP_CLIP_DEPTH);
+    BitmapRect R;
+    bmp_getclip(B, &R);
+
+    // Intersect with the current clip.  An empty intersection is kept as an
+    // empty rect, so nothing draws until it is popped.
+    int64_t x1 = (int64_t)x + MAX(w, 0), y1 = (int64_t)y + MAX(h, 0);
+    R.x0 = MAX(R.x0, x);
+    R.y0 = MAX(R.y0, y);
+    R.x1 = (int)MIN(R.x1, x1);
+    R.y1 = (int)MIN(R.y1, y1);
+    if (R.x1 < R.x0) R.x1 = R.x0;
+    if (R.y1 < R.y0) R.y1 = R.y0;
+    B->clip[B->clip_depth++] = R;
+}
+
+void bmp_popclip(BitmapImage* B) {
+    assert(B->clip_depth > 0);
+    B->clip_depth--;
+}
+
+BitmapPixel* bmp_pixelptr(BitmapImage* B, unsigned int x, unsigned int y) {
+    x -= B->x0;
+    y -= B->y0;
+
+    size_t pixel_offset = (size_t)ROWWIDTH(B->width) * y;
+    pixel_offset += (size_t)x * sizeof(BitmapPixel);
+    return PTR_BYTE_ADD(B->raw, pixel_offset);
+}
@@ -2,6 +2,7 @@
 #define _BMP_BASE_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 // TODO :
 // * Implement bitmap compression scheme(s).
@@ -38,11 +39,24 @@ typedef struct __attribute__((__packed__)) {
     uint32_t important_color_count;
 } BitmapDIBHeader;
 
+// A rectangle of pixels [x0, x1) x [y0, y1).
+typedef struct {
+    int x0, y0, x1, y1;
+} BitmapRect;
+
+#define BMP_CLIP_DEPTH 16
+
 typedef struct {
     uint8_t* img;
     int width;
     int height;
-    int imgsize;
+    size_t imgsize;
+    unsigned int x0, y0;    // Coordinates of the top left pixel.  (0, 0)
+                            // except for images that are tiles of a canvas.
+    BitmapRect clip[BMP_CLIP_DEPTH];    // Clip rectangles (see below)
+    uint8_t* alpha;         // Optional coverage plane, width x height bytes
+                            // with no padding; NULL except for layers.
+    int clip_depth;
     BitmapImageHeader* imghdr;
     BitmapDIBHeader* dibhdr;
     BitmapPixel* raw;
@@ -58,11 +72,42 @@ BitmapImage* bmp_create(int width, int height);
 // Write an in-memory bitmap object to a file
 void bmp_write(const char* filename, BitmapImage* B);
 
+// Fill in headers for a width x height bitmap.  Returns the file size.
+size_t bmp_headers(BitmapImageHeader* imghdr, BitmapDIBHeader* dibhdr,
+        int width, int height);
+
+// Writes all len bytes of buf to fd.
+void bmp_write_all(int fd, const void* buf, size_t len);
+
 // Cleans up memory used by a bitmap object
 void bmp_free(BitmapImage* B);
 
+// Pixel coordinates below are absolute: the top left pixel of the image is at
+// (x0, y0).  They are not checked; callers must stay inside the image (the
+// primitives in bmp.h clip for you).
+
 // Draws a pixel (specified as R, G, B)
 void bmp_drawrgbpixel(BitmapImage* B, unsigned int x, unsigned int y,
         uint8_t r, uint8_t g, uint8_t b);
 
+// Returns a pointer to the pixel at (x, y).  Pixels within a row are stored
+// contiguously, so span shaders can walk a row from here.
+BitmapPixel* bmp_pixelptr(BitmapImage* B, unsigned int x, unsigned int y);
+
+////////////////////////////////////////////////////////////////////////////////
+// Clipping ////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Each image keeps a stack of clip rectangles.  Drawing primitives clip their
+// geometry once against the top of the stack (or the whole image, if it is
+// empty) and never touch pixels outside it.
+
+// Narrows the clip to its intersection with the w x h rect at (x, y).
+void bmp_pushclip(BitmapImage* B, int x, int y, int w, int h);
+
+// Restores the clip from before the matching bmp_pushclip.
+void bmp_popclip(BitmapImage* B);
+
+// Returns the current clip rectangle.
+void bmp_getclip(BitmapImage* B, BitmapRect* R);
+
 #endif /* _BMP_BASE_H_ */
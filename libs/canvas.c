@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "canvas.h"
+#include "pyramid.h"
+
+#define PAD_TO(size, align) ((((((size)-1) / align)+1) * align))
+#define PTR_BYTE_ADD(p, x) ((void*)(((char*)(p))+(x)))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define SWAP(a, b) { typeof(a) tmp = a; a = b; b = tmp; }
+#define ROWWIDTH(width) (PAD_TO((width)*sizeof(BitmapPixel), 4))
+
+////////////////////////////////////////////////////////////////////////////////
+// Tiles ///////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+TiledCanvas* canvas_create(int64_t width, int64_t height, int tilesize,
+        uint8_t r, uint8_t g, uint8_t b) {
+    assert(width > 0 && width <= INT_MAX);
+    assert(height > 0 && height <= INT_MAX);
+    assert(tilesize > 0);
+
+    TiledCanvas* C = calloc(sizeof(TiledCanvas), 1);
+    assert(C);
+    C->width = width;
+    C->height = height;
+    C->tilesize = tilesize;
+    C->tiles_x = (width + tilesize - 1) / tilesize;
+    C->tiles_y = (height + tilesize - 1) / tilesize;
+    C->tiles = calloc(sizeof(BitmapImage*), C->tiles_x * C->tiles_y);
+    assert(C->tiles);
+    C->r = r;
+    C->g = g;
+    C->b = b;
+    return C;
+}
+
+void canvas_free(TiledCanvas* C) {
+    for (int64_t i = 0; i < C->tiles_x * C->tiles_y; i++) {
+        if (C->tiles[i]) bmp_free(C->tiles[i]);
+    }
+    free(C->tiles);
+    free(C);
+}
+
+// Fills n pixels with the background color.
+static void canvas_fill_bg(TiledCanvas* C, BitmapPixel* P, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        P[i].r = C->r;
+        P[i].g = C->g;
+        P[i].b = C->b;
+    }
+}
+
+// Returns tile (tx, ty), allocating it on first use.
+static BitmapImage* canvas_tile(TiledCanvas* C, int64_t tx, int64_t ty) {
+    BitmapImage** slot = &C->tiles[ty * C->tiles_x + tx];
+    if (*slot) return *slot;
+
+    int64_t x0 = tx * C->tilesize, y0 = ty * C->tilesize;
+    int w = (int)MIN(C->tilesize, C->width - x0);
+    int h = (int)MIN(C->tilesize, C->height - y0);
+    BitmapImage* T = bmp_create(w, h);
+    T->x0 = (unsigned int)x0;
+    T->y0 = (unsigned int)y0;
+    if (C->r || C->g || C->b) {
+        for (int j = 0; j < h; j++) {
+            canvas_fill_bg(C, PTR_BYTE_ADD(T->raw, (size_t)ROWWIDTH(w) * j), w);
+        }
+    }
+    C->tiles_allocated++;
+    *slot = T;
+    return T;
+}
+
+void canvas_getrgbpixel(TiledCanvas* C, int64_t x, int64_t y, BitmapPixel* px) {
+    assert(x >= 0 && x < C->width);
+    assert(y >= 0 && y < C->height);
+    BitmapImage* T = C->tiles[(y / C->tilesize) * C->tiles_x + x / C->tilesize];
+    if (!T) {
+        canvas_fill_bg(C, px, 1);
+        return;
+    }
+    *px = *bmp_pixelptr(T, (unsigned int)x, (unsigned int)y);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Drawing /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+void canvas_drawrect(TiledCanvas* C,
+        int64_t x, int64_t y,
+        int64_t w, int64_t h,
+        DrawFn* d) {
+    // Clip to the canvas.
+    int64_t xa = MAX(x, 0), xb = MIN(x + w, C->width);
+    int64_t ya = MAX(y, 0), yb = MIN(y + h, C->height);
+    if (xa >= xb || ya >= yb) return;
+
+    // Hand each tile its piece.
+    int64_t ts = C->tilesize;
+    for (int64_t ty = ya / ts; ty * ts < yb; ty++) {
+        int64_t y0 = MAX(ya, ty * ts), y1 = MIN(yb, (ty + 1) * ts);
+        for (int64_t tx = xa / ts; tx * ts < xb; tx++) {
+            int64_t x0 = MAX(xa, tx * ts), x1 = MIN(xb, (tx + 1) * ts);
+            bmp_drawrect(canvas_tile(C, tx, ty), x0, y0, x1 - x0, y1 - y0, d);
+        }
+    }
+}
+
+// As internal_pt_on_line in bmp.c, in 64 bits.
+static int64_t canvas_pt_on_line(
+        int64_t x1, int64_t y1,
+        int64_t x2, int64_t y2,
+        int64_t x) {
+    if (x1 == x2) {
+        return y1;
+    }
+    if (x1 > x2) {
+        SWAP(x1, x2);
+        SWAP(y1, y2);
+    }
+    return (x - x1) * (y2 - y1) / (x2 - x1) + y1;
+}
+
+void canvas_drawtriangle(TiledCanvas* C,
+        int64_t x1, int64_t y1,
+        int64_t x2, int64_t y2,
+        int64_t x3, int64_t y3,
+        DrawFn* d) {
+    // Sort points such that y1 <= y2 <= y3
+    if (y1 > y2) {
+        SWAP(y1, y2);
+        SWAP(x1, x2);
+    } if (y1 > y3) {
+        SWAP(y1, y3);
+        SWAP(x1, x3);
+    } if (y2 > y3) {
+        SWAP(y2, y3);
+        SWAP(x2, x3);
+    }
+
+    // For each horizontal line in the triangle (and the canvas), fill from
+    // left to right.
+    for (int64_t y = MAX(y1, 0); y <= MIN(y3, C->height - 1); y++) {
+        int64_t xl = canvas_pt_on_line(y1, x1, y3, x3, y);
+        int64_t xs = (y > y2) ? canvas_pt_on_line(y2, x2, y3, x3, y) :
+            canvas_pt_on_line(y1, x1, y2, x2, y);
+        int64_t xleft = MIN(xl, xs), xright = MAX(xl, xs);
+        canvas_drawrect(C, xleft, y, xright - xleft + 1, 1, d);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output //////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Fills rows [y, y+n) of the canvas into rows, packed with no padding.
+static void canvas_fill_rows(void* arg, int y, int n, BitmapPixel* rows) {
+    TiledCanvas* C = arg;
+    for (int r = 0; r < n; r++) {
+        int64_t cy = (int64_t)y + r;
+        int64_t ty = cy / C->tilesize;
+        BitmapPixel* row = &rows[(size_t)r * C->width];
+        for (int64_t tx = 0; tx < C->tiles_x; tx++) {
+            BitmapImage* T = C->tiles[ty * C->tiles_x + tx];
+            int64_t x0 = tx * C->tilesize;
+            int w = (int)MIN(C->tilesize, C->width - x0);
+            if (T) {
+                memcpy(&row[x0], bmp_pixelptr(T, (unsigned int)x0, (unsigned int)cy),
+                        sizeof(BitmapPixel) * w);
+            } else {
+                canvas_fill_bg(C, &row[x0], w);
+            }
+        }
+    }
+}
+
+void canvas_write(const char* filename, TiledCanvas* C) {
+    assert(C->width <= INT_MAX && C->height <= INT_MAX);
+    BitmapImageHeader imghdr;
+    BitmapDIBHeader dibhdr;
+    size_t size = bmp_headers(&imghdr, &dibhdr, (int)C->width, (int)C->height);
+    assert(size <= UINT32_MAX);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IROTH);
+    assert(fd >= 0);
+    bmp_write_all(fd, &imghdr, sizeof(imghdr));
+    bmp_write_all(fd, &dibhdr, sizeof(dibhdr));
+
+    // One row of tiles at a time, padded out to BMP rows.
+    size_t rowwidth = ROWWIDTH(C->width);
+    BitmapPixel* rows = malloc(sizeof(BitmapPixel) * C->width * C->tilesize);
+    uint8_t* out = calloc(rowwidth, C->tilesize);
+    assert(rows && out);
+    for (int64_t y = 0; y < C->height; y += C->tilesize) {
+        int n = (int)MIN(C->tilesize, C->height - y);
+        canvas_fill_rows(C, (int)y, n, rows);
+        for (int r = 0; r < n; r++) {
+            memcpy(out + rowwidth * r, &rows[(size_t)r * C->width],
+                    sizeof(BitmapPixel) * C->width);
+        }
+        bmp_write_all(fd, out, rowwidth * n);
+    }
+    assert(close(fd) == 0);
+    free(rows);
+    free(out);
+}
+
+// Fills rows [y, y+n) counted from the top, as pyramid_write_stream wants.
+// Canvas row 0 is the bottom row of the image (as in a BMP).
+static void canvas_fill_rows_topdown(void* arg, int y, int n, BitmapPixel* rows) {
+    TiledCanvas* C = arg;
+    for (int r = 0; r < n; r++) {
+        canvas_fill_rows(C, (int)(C->height - 1 - y - r), 1,
+                &rows[(size_t)r * C->width]);
+    }
+}
+
+void canvas_write_pyramid(const char* dir, TiledCanvas* C, int tilesize) {
+    assert(C->width <= INT_MAX && C->height <= INT_MAX);
+    pyramid_write_stream(dir, (int)C->width, (int)C->height, tilesize,
+            &canvas_fill_rows_topdown, C);
+}
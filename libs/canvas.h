@@ -0,0 +1,61 @@
+#ifndef _CANVAS_H_
+#define _CANVAS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bmp.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Tiled canvases //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// A canvas for renders too large to hold in memory all at once.  The canvas is
+// split into square tiles, each allocated only when something is first drawn
+// on it; tiles never drawn on read back as the background color.  Memory use
+// follows the painted area rather than the canvas size.
+//
+// Coordinates and sizes are 64-bit, and geometry may extend past the canvas
+// (it is clipped).  Each side of the canvas is limited to INT_MAX pixels, since
+// the bitmap primitives take int coordinates; DrawFns see absolute canvas
+// coordinates.
+
+typedef struct {
+    int64_t width, height;
+    int tilesize;
+    int64_t tiles_x, tiles_y;
+    BitmapImage** tiles;    // Row major; NULL until first drawn on
+    int64_t tiles_allocated;
+    uint8_t r, g, b;        // Background color
+} TiledCanvas;
+
+// Create a canvas with the given background color.
+TiledCanvas* canvas_create(int64_t width, int64_t height, int tilesize,
+        uint8_t r, uint8_t g, uint8_t b);
+
+// Cleans up memory used by a canvas.
+void canvas_free(TiledCanvas* C);
+
+// Reads back a pixel.
+void canvas_getrgbpixel(TiledCanvas* C, int64_t x, int64_t y, BitmapPixel* px);
+
+// Draw a rectangle (specified by top left, width, and height)
+void canvas_drawrect(TiledCanvas* C,
+        int64_t x, int64_t y,
+        int64_t w, int64_t h,
+        DrawFn* d);
+
+// Draw a triangle (specified by vertices), rasterized as bmp_drawtriangle.
+void canvas_drawtriangle(TiledCanvas* C,
+        int64_t x1, int64_t y1,
+        int64_t x2, int64_t y2,
+        int64_t x3, int64_t y3,
+        DrawFn* d);
+
+// Streams the canvas out to a BMP file one row of tiles at a time.  The
+// format limits this to canvases under 4GB; use canvas_write_pyramid beyond
+// that.
+void canvas_write(const char* filename, TiledCanvas* C);
+
+// Streams the canvas out as a tile pyramid (see pyramid.h).
+void canvas_write_pyramid(const char* dir, TiledCanvas* C, int tilesize);
+
+#endif /* _CANVAS_H_ */
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include "bmp_base.h"
+#include "dither.h"
+#include "parallel.h"
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+#define CLAMP255(i) ((i) < 0 ? 0 : ((i) > 255 ? 255 : (i)))
+
+#define DITHER_LUT_BITS 5
+#define DITHER_LUT_SIDE (1 << DITHER_LUT_BITS)
+#define DITHER_LUT_CELLS (DITHER_LUT_SIDE * DITHER_LUT_SIDE * DITHER_LUT_SIDE)
+#define DITHER_BLOCK 64     // Pixels a row does between progress updates
+#define DITHER_PAD 2        // Error buffer columns past each edge of a row
+
+////////////////////////////////////////////////////////////////////////////////
+// Nearest color lookup ////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Color space is cut into DITHER_LUT_CELLS cubes.  Each cube keeps the list of
+// palette colors that can be nearest to some point inside it: those whose
+// nearest distance to the cube is no more than the smallest farthest distance
+// of any color.  Lookups search only the list for their cube, which is
+// usually a color or two, and give exactly the nearest color.
+
+typedef struct {
+    const BitmapPixel* palette;
+    int* start;         // Cube i's candidates are cand[start[i] .. start[i+1])
+    uint8_t* cand;      // Palette indices, in increasing order
+} dither_lut_t;
+
+static inline int dither_cube(int r, int g, int b) {
+    int s = 8 - DITHER_LUT_BITS;
+    return ((r >> s) << (2 * DITHER_LUT_BITS)) | ((g >> s) << DITHER_LUT_BITS) | (b >> s);
+}
+
+// Squared distances from channel value c to the nearest and farthest points
+// of [lo, hi].
+static inline void dither_span_dist(int c, int lo, int hi, int* near, int* far) {
+    int n = (c < lo) ? lo - c : ((c > hi) ? c - hi : 0);
+    int f = MAX(c - lo, hi - c);
+    *near += n * n;
+    *far += f * f;
+}
+
+static void dither_lut_build(dither_lut_t* L, const BitmapPixel* palette,
+        int ncolors) {
+    int side = 256 / DITHER_LUT_SIDE;
+    int* nearest = malloc(sizeof(int) * ncolors);
+    L->palette = palette;
+    L->start = malloc(sizeof(int) * (DITHER_LUT_CELLS + 1));
+    size_t capacity = DITHER_LUT_CELLS * 2;
+    L->cand = malloc(capacity);
+    assert(nearest && L->start && L->cand);
+
+    size_t n = 0;
+    for (int i = 0; i < DITHER_LUT_CELLS; i++) {
+        int r0 = (i >> (2 * DITHER_LUT_BITS)) * side;
+        int g0 = ((i >> DITHER_LUT_BITS) & (DITHER_LUT_SIDE - 1)) * side;
+        int b0 = (i & (DITHER_LUT_SIDE - 1)) * side;
+
+        int bound = INT32_MAX;
+        for (int k = 0; k < ncolors; k++) {
+            int near = 0, far = 0;
+            dither_span_dist(palette[k].r, r0, r0 + side - 1, &near, &far);
+            dither_span_dist(palette[k].g, g0, g0 + side - 1, &near, &far);
+            dither_span_dist(palette[k].b, b0, b0 + side - 1, &near, &far);
+            nearest[k] = near;
+            bound = MIN(bound, far);
+        }
+
+        L->start[i] = (int)n;
+        for (int k = 0; k < ncolors; k++) {
+            if (nearest[k] > bound) continue;
+            if (n == capacity) {
+                capacity *= 2;
+                L->cand = realloc(L->cand, capacity);
+                assert(L->cand);
+            }
+            L->cand[n++] = (uint8_t)k;
+        }
+    }
+    L->start[DITHER_LUT_CELLS] = (int)n;
+    free(nearest);
+}
+
+static inline int dither_nearest(dither_lut_t* L, int r, int g, int b) {
+    int cube = dither_cube(r, g, b);
+    int best = L->cand[L->start[cube]], bestdist = INT32_MAX;
+    for (int i = L->start[cube]; i < L->start[cube + 1]; i++) {
+        const BitmapPixel* p = &L->palette[L->cand[i]];
+        int dr = r - p->r, dg = g - p->g, db = b - p->b;
+        int dist = dr * dr + dg * dg + db * db;
+        if (dist < bestdist) {
+            bestdist = dist;
+            best = L->cand[i];
+        }
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Error diffusion /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Errors are kept in fixed point, in sixteenths of a color step.  Error a row
+// passes to later rows accumulates in a ring of row buffers; error it passes
+// to its own next pixels is carried along in locals.
+//
+// Pixel (x, r) takes error from row r-1 up to pixel x+1 (and from row r-2 up
+// to pixel x), so row r may work on pixel x once row r-1 has finished x+1.
+// Rows publish how far they have got every DITHER_BLOCK pixels.  While row r
+// adds into a buffer, any other row adding into the same buffer is at least
+// two pixels behind it or ahead of it, so the two never touch the same entry.
+// Error is added up in the same amounts whatever the order, so the result
+// doesn't depend on how the rows were scheduled.
+
+typedef struct {
+    int right1, right2;     // Weights (in sixteenths) for (x+1, r), (x+2, r)
+    int downleft, down, downright;  // ... for (x-1, r+1), (x, r+1), (x+1, r+1)
+    int down2;              // ... for (x, r+2)
+} dither_kernel_t;
+
+static const dither_kernel_t dither_kernels[] = {
+    [DITHER_FLOYD_STEINBERG] = { 7, 0, 3, 5, 1, 0 },
+    [DITHER_ATKINSON]        = { 2, 2, 2, 2, 2, 2 },
+};
+
+typedef struct {
+    BitmapImage* B;
+    const dither_kernel_t* K;
+    dither_lut_t* L;
+    int32_t* err;       // Ring of nrows error rows
+    int nrows;
+    size_t stride;      // int32s per error row
+    int* progress;      // Pixels finished per image row; updated atomically
+} dither_t;
+
+static inline int32_t* dither_errrow(dither_t* D, int r) {
+    return &D->err[(size_t)(r % D->nrows) * D->stride + 3 * DITHER_PAD];
+}
+
+static void dither_row(void* arg, int r) {
+    dither_t* D = arg;
+    BitmapImage* B = D->B;
+    const dither_kernel_t* K = D->K;
+    int w = B->width;
+    int32_t* cur = dither_errrow(D, r);
+    int32_t* down1 = dither_errrow(D, r + 1);
+    int32_t* down2 = dither_errrow(D, r + 2);
+    int32_t carry1[3] = { 0, 0, 0 }, carry2[3] = { 0, 0, 0 };
+    uint8_t* P = (uint8_t*)bmp_pixelptr(B, B->x0, B->y0 + r);
+
+    for (int xstart = 0; xstart < w; xstart += DITHER_BLOCK) {
+        int xend = MIN(xstart + DITHER_BLOCK, w);
+
+        // Wait for the row above to finish up to one past this block.
+        if (r > 0) {
+            int need = MIN(xend + 1, w);
+            while (__atomic_load_n(&D->progress[r - 1], __ATOMIC_ACQUIRE) < need) {
+                sched_yield();
+            }
+        }
+
+        for (int x = xstart; x < xend; x++) {
+            int v[3];
+            for (int c = 0; c < 3; c++) {
+                int32_t e = cur[3*x + c] + carry1[c];
+                v[c] = CLAMP255(P[3*x + c] + ((e + 8) >> 4));
+                cur[3*x + c] = 0;
+            }
+
+            // BitmapPixel is stored b, g, r.
+            int k = dither_nearest(D->L, v[2], v[1], v[0]);
+            const BitmapPixel* p = &D->L->palette[k];
+            P[3*x] = p->b;
+            P[3*x + 1] = p->g;
+            P[3*x + 2] = p->r;
+
+            int e[3] = { v[0] - p->b, v[1] - p->g, v[2] - p->r };
+            for (int c = 0; c < 3; c++) {
+                carry1[c] = carry2[c] + K->right1 * e[c];
+                carry2[c] = K->right2 * e[c];
+                down1[3*(x-1) + c] += K->downleft * e[c];
+                down1[3*x + c] += K->down * e[c];
+                down1[3*(x+1) + c] += K->downright * e[c];
+                down2[3*x + c] += K->down2 * e[c];
+            }
+        }
+
+        __atomic_store_n(&D->progress[r], xend, __ATOMIC_RELEASE);
+    }
+
+    // Everything that adds into this row's buffer is done with it now (the
+    // row above finished before our last block), so clear the padding it
+    // spilled into for the row that reuses the buffer.
+    for (int c = 0; c < 3 * DITHER_PAD; c++) {
+        cur[c - 3 * DITHER_PAD] = 0;
+        cur[3 * w + c] = 0;
+    }
+}
+
+void bmp_dither(BitmapImage* B, const BitmapPixel* palette, int ncolors,
+        DitherKernel kernel) {
+    assert(ncolors > 0 && ncolors <= 256);
+    assert(kernel == DITHER_FLOYD_STEINBERG || kernel == DITHER_ATKINSON);
+
+    dither_lut_t L;
+    dither_lut_build(&L, palette, ncolors);
+
+    // At most par_nthreads() rows are in flight at once, and they are
+    // consecutive (a row can't finish before the one above it).  They, and
+    // the two rows below them, need error buffers.
+    dither_t D;
+    D.B = B;
+    D.K = &dither_kernels[kernel];
+    D.L = &L;
+    D.nrows = par_nthreads() + 3;
+    D.stride = 3 * ((size_t)B->width + 2 * DITHER_PAD);
+    D.err = calloc(D.nrows * D.stride, sizeof(int32_t));
+    D.progress = calloc(B->height, sizeof(int));
+    assert(D.err && D.progress);
+
+    par_for(B->height, &dither_row, &D);
+
+    free(D.progress);
+    free(D.err);
+    free(L.cand);
+    free(L.start);
+}
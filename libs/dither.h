@@ -0,0 +1,33 @@
+#ifndef _DITHER_H_
+#define _DITHER_H_
+
+#include <stdint.h>
+#include "bmp_base.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Dithering ///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Reduce an image to a fixed palette by error diffusion.  Each pixel is
+// replaced by the nearest palette color (in RGB), and the difference is
+// spread over the pixels to its right and in the following rows:
+//
+//     Floyd-Steinberg          Atkinson
+//
+//          *  7/16                  *  1/8  1/8
+//     3/16 5/16 1/16           1/8  1/8  1/8
+//                                   1/8
+//
+// Rows are taken in order of increasing y, pixels left to right.  Rows run on
+// par_nthreads() threads as a wavefront, each trailing the row before it, and
+// the result is identical to dithering on one thread.
+
+typedef enum {
+    DITHER_FLOYD_STEINBERG,
+    DITHER_ATKINSON
+} DitherKernel;
+
+// Dither B in place to the ncolors (at most 256) colors of palette.
+void bmp_dither(BitmapImage* B, const BitmapPixel* palette, int ncolors,
+        DitherKernel kernel);
+
+#endif /* _DITHER_H_ */
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "bmp.h"
+#include "layer.h"
+#include "parallel.h"
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+
+// x / 255, rounded, for x on [0, 255*255].
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+// Pixels per block in layer_flatten, and rows handed to a thread at a time.
+#define LAYER_PIXELS 32
+#define LAYER_LANES (3 * LAYER_PIXELS)
+#define LAYER_BAND 16
+
+////////////////////////////////////////////////////////////////////////////////
+// Layers //////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+Layer* layer_create(BitmapImage* B, double opacity, BlendMode mode) {
+    assert(opacity >= 0.0 && opacity <= 1.0);
+    Layer* L = malloc(sizeof(Layer));
+    assert(L);
+    L->img = bmp_create(B->width, B->height);
+    L->img->x0 = B->x0;
+    L->img->y0 = B->y0;
+    L->img->alpha = calloc((size_t)B->width * B->height, 1);
+    assert(L->img->alpha);
+    L->opacity = opacity;
+    L->mode = mode;
+    return L;
+}
+
+void layer_free(Layer* L) {
+    bmp_free(L->img);
+    free(L);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Flattening //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Each block of LAYER_PIXELS pixels of the target is loaded once, every layer
+// is blended into it in turn, and it is stored once.  Within a block the
+// channels are treated as a flat array of LAYER_LANES bytes (the alpha is
+// spread over each pixel's three channels first), so the blend loops are plain
+// elementwise integer math that the compiler vectorizes.
+
+typedef struct {
+    BitmapImage* B;
+    Layer** layers;
+    int n;
+    int* opacity;   // Per layer, on [0, 255]
+} flatten_t;
+
+// Blends one block of npx pixels of layer L, at (x, y) relative to the image's
+// origin, into d.
+static inline void layer_blend_block(Layer* L, int opacity, int x, int y,
+        int npx, uint16_t* restrict d) {
+    BitmapImage* I = L->img;
+    const uint8_t* A = &I->alpha[(size_t)y * I->width + x];
+    const uint8_t* src = (const uint8_t*)bmp_pixelptr(I, I->x0 + x, I->y0 + y);
+    uint16_t a[LAYER_LANES], s[LAYER_LANES];
+    int nb = 3 * npx;
+
+    // Skip blocks the layer never drew on.
+    int any = 0;
+    for (int i = 0; i < npx; i++) any |= A[i];
+    if (!any) return;
+
+    // Effective alpha per channel, and the premultiplied color.
+    for (int i = 0; i < npx; i++) {
+        uint16_t v = DIV255(A[i] * opacity);
+        a[3*i] = a[3*i + 1] = a[3*i + 2] = v;
+    }
+    for (int k = 0; k < nb; k++) {
+        s[k] = DIV255(src[k] * a[k]);
+    }
+
+    switch (L->mode) {
+    case BLEND_NORMAL:
+        for (int k = 0; k < nb; k++) {
+            d[k] = s[k] + DIV255(d[k] * (255 - a[k]));
+        }
+        break;
+    case BLEND_MULTIPLY:
+        for (int k = 0; k < nb; k++) {
+            uint16_t v = DIV255(s[k] * d[k]) + DIV255(d[k] * (255 - a[k]));
+            d[k] = MIN(v, 255);
+        }
+        break;
+    case BLEND_SCREEN:
+        for (int k = 0; k < nb; k++) {
+            d[k] = s[k] + d[k] - DIV255(s[k] * d[k]);
+        }
+        break;
+    case BLEND_ADD:
+        for (int k = 0; k < nb; k++) {
+            uint16_t v = s[k] + d[k];
+            d[k] = MIN(v, 255);
+        }
+        break;
+    }
+}
+
+static void layer_flatten_band(void* arg, int band) {
+    flatten_t* F = arg;
+    BitmapImage* B = F->B;
+    int ystart = band * LAYER_BAND;
+    int yend = MIN(ystart + LAYER_BAND, B->height);
+    uint16_t d[LAYER_LANES];
+
+    for (int y = ystart; y < yend; y++) {
+        uint8_t* row = (uint8_t*)bmp_pixelptr(B, B->x0, B->y0 + y);
+        for (int x = 0; x < B->width; x += LAYER_PIXELS) {
+            int npx = MIN(LAYER_PIXELS, B->width - x);
+            uint8_t* P = &row[3 * x];
+            for (int k = 0; k < 3 * npx; k++) d[k] = P[k];
+            for (int l = 0; l < F->n; l++) {
+                layer_blend_block(F->layers[l], F->opacity[l], x, y, npx, d);
+            }
+            for (int k = 0; k < 3 * npx; k++) P[k] = (uint8_t)d[k];
+        }
+    }
+}
+
+void layer_flatten(BitmapImage* B, Layer** layers, int n) {
+    flatten_t F = { B, layers, n, malloc(sizeof(int) * (n > 0 ? n : 1)) };
+    assert(F.opacity);
+    for (int l = 0; l < n; l++) {
+        BitmapImage* I = layers[l]->img;
+        assert(I->width == B->width && I->height == B->height);
+        assert(I->x0 == B->x0 && I->y0 == B->y0);
+        assert(I->alpha);
+        F.opacity[l] = (int)(layers[l]->opacity * 255.0 + 0.5);
+    }
+
+    par_for((B->height + LAYER_BAND - 1) / LAYER_BAND, &layer_flatten_band, &F);
+    free(F.opacity);
+}
@@ -0,0 +1,47 @@
+#ifndef _LAYER_H_
+#define _LAYER_H_
+
+#include <stdint.h>
+#include "bmp_base.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Layers //////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// A layer is a bitmap with an alpha plane, drawn into with the usual
+// primitives and DrawFns through its img member.  Every pixel starts out
+// transparent; primitives mark what they draw as opaque, and the edges of
+// anti-aliased shapes as partly covered.
+//
+// Layers are combined into an ordinary bitmap by layer_flatten, which
+// composites them bottom to top with premultiplied alpha.  With s the layer's
+// color, d the color below, and a its alpha times the layer's opacity (all on
+// [0, 1]), the blend modes are:
+//
+//     normal      s*a + d*(1-a)
+//     multiply    s*a*d + d*(1-a)
+//     screen      s*a + d - s*a*d
+//     add         min(s*a + d, 1)
+
+typedef enum {
+    BLEND_NORMAL,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN,
+    BLEND_ADD
+} BlendMode;
+
+typedef struct {
+    BitmapImage* img;   // Color, and the alpha plane in img->alpha
+    double opacity;     // On [0, 1]
+    BlendMode mode;
+} Layer;
+
+// Create a transparent layer the size of B, with the same origin.
+Layer* layer_create(BitmapImage* B, double opacity, BlendMode mode);
+
+// Cleans up memory used by a layer.
+void layer_free(Layer* L);
+
+// Composites n layers, first to last, onto B in a single pass over it.
+void layer_flatten(BitmapImage* B, Layer** layers, int n);
+
+#endif /* _LAYER_H_ */
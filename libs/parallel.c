@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "parallel.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Thread helpers //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+int par_nthreads() {
+    const char* env = getenv("PAR_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+typedef struct {
+    void (*fn)(void*, int);
+    void* arg;
+    int n;
+    int next;   // Next index to hand out; updated atomically
+} par_for_t;
+
+static void* internal_par_for_worker(void* p) {
+    par_for_t* P = p;
+    int i;
+    while ((i = __atomic_fetch_add(&P->next, 1, __ATOMIC_RELAXED)) < P->n) {
+        P->fn(P->arg, i);
+    }
+    return NULL;
+}
+
+void par_for(int n, void (*fn)(void*, int), void* arg) {
+    par_for_t P = { fn, arg, n, 0 };
+    int nthreads = par_nthreads();
+    if (nthreads > n) nthreads = n;
+
+    // The calling thread works too, so only spawn nthreads-1 helpers.
+    pthread_t* threads = malloc(sizeof(pthread_t) * (nthreads > 1 ? nthreads - 1 : 1));
+    assert(threads);
+    int spawned = 0;
+    for (; spawned < nthreads - 1; spawned++) {
+        if (pthread_create(&threads[spawned], NULL, &internal_par_for_worker, &P)) {
+            break; // Out of threads; the remaining ones will pick up the slack
+        }
+    }
+    internal_par_for_worker(&P);
+    for (int t = 0; t < spawned; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fork-join tasks /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Each thread owns a deque of spawned tasks.  The owner pushes and pops at the
+// bottom, so it runs its own work depth first; thieves take from the top.  The
+// deques are short (a few tasks per level of recursion), so a lock per deque
+// is cheap enough and keeps this simple.
+
+#define PAR_DEQUE_SIZE 1024
+
+typedef struct {
+    pthread_mutex_t lock;
+    par_task* tasks[PAR_DEQUE_SIZE];
+    int top, bottom;    // Tasks waiting are tasks[top .. bottom)
+} par_deque_t;
+
+typedef struct {
+    par_deque_t* deques;
+    int nworkers;
+    int finished;       // Set once the root task returns; updated atomically
+} par_pool_t;
+
+typedef struct {
+    par_pool_t* pool;
+    int id;
+} par_worker_t;
+
+// The pool and deque of the current thread; NULL outside of par_run.
+static __thread par_pool_t* par_pool = NULL;
+static __thread int par_id = 0;
+static __thread unsigned int par_seed = 0;
+
+static inline void internal_par_execute(par_task* t) {
+    t->fn(t->arg);
+    __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+}
+
+// Steals and runs one task from some other thread.  Returns 0 if there was
+// nothing to steal.
+static int internal_par_steal() {
+    par_pool_t* P = par_pool;
+    int start = rand_r(&par_seed) % P->nworkers;
+    for (int i = 0; i < P->nworkers; i++) {
+        int victim = (start + i) % P->nworkers;
+        if (victim == par_id) continue;
+        par_deque_t* D = &P->deques[victim];
+        par_task* t = NULL;
+        pthread_mutex_lock(&D->lock);
+        if (D->top < D->bottom) {
+            t = D->tasks[D->top++];
+        }
+        pthread_mutex_unlock(&D->lock);
+        if (t) {
+            internal_par_execute(t);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* internal_par_run_worker(void* p) {
+    par_worker_t* W = p;
+    par_pool = W->pool;
+    par_id = W->id;
+    par_seed = W->id;
+    while (!__atomic_load_n(&par_pool->finished, __ATOMIC_ACQUIRE)) {
+        if (!internal_par_steal()) {
+            sched_yield();
+        }
+    }
+    par_pool = NULL;
+    return NULL;
+}
+
+void par_run(void (*fn)(void*), void* arg) {
+    // Nested runs share the pool already running.
+    if (par_pool) {
+        fn(arg);
+        return;
+    }
+
+    par_pool_t P = { NULL, par_nthreads(), 0 };
+    P.deques = malloc(sizeof(par_deque_t) * P.nworkers);
+    par_worker_t* W = malloc(sizeof(par_worker_t) * P.nworkers);
+    pthread_t* threads = malloc(sizeof(pthread_t) * P.nworkers);
+    assert(P.deques && W && threads);
+    for (int i = 0; i < P.nworkers; i++) {
+        pthread_mutex_init(&P.deques[i].lock, NULL);
+        P.deques[i].top = P.deques[i].bottom = 0;
+        W[i].pool = &P;
+        W[i].id = i;
+    }
+
+    // The calling thread is worker 0.
+    int spawned = 1;
+    for (; spawned < P.nworkers; spawned++) {
+        if (pthread_create(&threads[spawned], NULL, &internal_par_run_worker, &W[spawned])) {
+            break; // Out of threads; fewer workers will do
+        }
+    }
+    par_pool = &P;
+    par_id = 0;
+    fn(arg);
+    par_pool = NULL;
+    __atomic_store_n(&P.finished, 1, __ATOMIC_RELEASE);
+
+    for (int i = 1; i < spawned; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < P.nworkers; i++) {
+        pthread_mutex_destroy(&P.deques[i].lock);
+    }
+    free(threads);
+    free(W);
+    free(P.deques);
+}
+
+void par_spawn(par_task* t, void (*fn)(void*), void* arg) {
+    t->fn = fn;
+    t->arg = arg;
+    t->done = 0;
+    if (!par_pool) {
+        internal_par_execute(t);
+        return;
+    }
+
+    par_deque_t* D = &par_pool->deques[par_id];
+    pthread_mutex_lock(&D->lock);
+    if (D->top == D->bottom) {
+        D->top = D->bottom = 0;
+    }
+    assert(D->bottom < PAR_DEQUE_SIZE);
+    D->tasks[D->bottom++] = t;
+    pthread_mutex_unlock(&D->lock);
+}
+
+void par_sync(par_task* t) {
+    if (!par_pool) {
+        return;
+    }
+
+    // If nobody stole it, it is still at the bottom of our deque.
+    par_deque_t* D = &par_pool->deques[par_id];
+    int mine = 0;
+    pthread_mutex_lock(&D->lock);
+    if (D->top < D->bottom && D->tasks[D->bottom - 1] == t) {
+        D->bottom--;
+        mine = 1;
+    }
+    pthread_mutex_unlock(&D->lock);
+    if (mine) {
+        internal_par_execute(t);
+        return;
+    }
+
+    // Otherwise help out elsewhere until the thief is done with it.
+    while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+        if (!internal_par_steal()) {
+            sched_yield();
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+////////////////////////////////////////////////////////////////////////////////
+// Thread helpers //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Number of threads parallel work is spread over.  Defaults to the number of
+// online CPUs; override with the PAR_THREADS environment variable.
+int par_nthreads();
+
+// Calls fn(arg, i) once for every i on [0, n), spread over par_nthreads()
+// threads.  Indices are handed out dynamically, so uneven work balances out.
+// Returns once every call has finished.
+void par_for(int n, void (*fn)(void*, int), void* arg);
+
+////////////////////////////////////////////////////////////////////////////////
+// Fork-join tasks /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// A work-stealing scheduler for recursive, divide-and-conquer work.  Inside
+// par_run, par_spawn pushes a task onto the calling thread's own deque, and
+// idle threads steal the oldest tasks (the biggest subproblems) from others.
+// Every spawned task must be passed to par_sync before the function that
+// spawned it returns, and tasks are synced in reverse order of spawning.
+//
+// Outside of par_run, par_spawn just runs the task on the spot.
+
+typedef struct {
+    void (*fn)(void*);
+    void* arg;
+    int done;   // Set once fn has returned; updated atomically
+} par_task;
+
+// Runs fn(arg) with par_nthreads() threads available to its tasks, and
+// returns once it and every task it spawned have finished.
+void par_run(void (*fn)(void*), void* arg);
+
+// Makes fn(arg) available to run in parallel with the caller.  t must stay
+// valid until par_sync(t) returns.
+void par_spawn(par_task* t, void (*fn)(void*), void* arg);
+
+// Waits for a spawned task, running it here if no other thread has taken it.
+void par_sync(par_task* t);
+
+#endif /* _PARALLEL_H_ */
@@ -0,0 +1,744 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "png.h"
+#include "parallel.h"
+#ifdef PNG_USE_ZLIB
+#include <zlib.h>
+#endif
+
+#define PAD_TO(size, align) ((((((size)-1) / align)+1) * align))
+#define PTR_BYTE_ADD(p, x) ((void*)(((char*)(p))+(x)))
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define ROWWIDTH(width) (PAD_TO((width)*sizeof(BitmapPixel), 4))
+
+// Target amount of filtered image data per independently compressed band.
+#define PNG_BAND_BYTES (1 << 20)
+
+////////////////////////////////////////////////////////////////////////////////
+// Checksums ///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+#define ADLER_BASE 65521u
+
+static uint32_t png_crc_table[256];
+
+static void png_crc_init() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        png_crc_table[n] = c;
+    }
+}
+
+// Continues a CRC-32 (start from 0).
+static uint32_t png_crc(uint32_t crc, const uint8_t* buf, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = png_crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Continues an Adler-32 (start from 1).
+static uint32_t png_adler(uint32_t adler, const uint8_t* buf, size_t len) {
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (len) {
+        // 5552 is the most bytes that can be summed before b can overflow.
+        size_t n = MIN(len, 5552);
+        len -= n;
+        for (size_t i = 0; i < n; i++) {
+            a += buf[i];
+            b += a;
+        }
+        buf += n;
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of two buffers joined, given the checksum of each and the length of
+// the second (as zlib's adler32_combine).
+static uint32_t png_adler_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+    uint32_t rem = (uint32_t)(len2 % ADLER_BASE);
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % ADLER_BASE);
+    sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum2 >= (ADLER_BASE << 1)) sum2 -= (ADLER_BASE << 1);
+    if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+    return (sum2 << 16) | sum1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output buffers //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    uint8_t* buf;
+    size_t len, cap;
+    uint64_t bits;  // Pending bits, least significant first
+    int nbits;
+} png_buf;
+
+static void png_buf_reserve(png_buf* o, size_t extra) {
+    if (o->len + extra <= o->cap) return;
+    while (o->len + extra > o->cap) {
+        o->cap = o->cap ? o->cap * 2 : 4096;
+    }
+    o->buf = realloc(o->buf, o->cap);
+    assert(o->buf);
+}
+
+static void png_buf_append(png_buf* o, const void* p, size_t len) {
+    if (len == 0) return;   // p may be NULL
+    png_buf_reserve(o, len);
+    memcpy(o->buf + o->len, p, len);
+    o->len += len;
+}
+
+static void png_buf_be32(png_buf* o, uint32_t v) {
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+    png_buf_append(o, b, 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Deflate /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// A small deflate encoder (RFC 1951): greedy LZ77 matching over hash chains,
+// and a dynamic Huffman block (or a stored one, if smaller) per run of
+// symbols.  Each band is compressed on its own, with no history from earlier
+// bands.
+
+#ifndef PNG_USE_ZLIB
+
+// Writes the low n bits of value (n <= 32), deflate order.
+static inline void png_putbits(png_buf* o, uint32_t value, int n) {
+    o->bits |= (uint64_t)value << o->nbits;
+    o->nbits += n;
+    if (o->nbits >= 32) {
+        png_buf_reserve(o, 4);
+        uint8_t* p = o->buf + o->len;
+        p[0] = o->bits;
+        p[1] = o->bits >> 8;
+        p[2] = o->bits >> 16;
+        p[3] = o->bits >> 24;
+        o->len += 4;
+        o->bits >>= 32;
+        o->nbits -= 32;
+    }
+}
+
+// Pads with zero bits to a byte boundary and flushes.
+static void png_alignbits(png_buf* o) {
+    while (o->nbits > 0) {
+        uint8_t b = o->bits;
+        png_buf_append(o, &b, 1);
+        o->bits >>= 8;
+        o->nbits -= 8;
+    }
+    o->bits = 0;
+    o->nbits = 0;
+}
+
+#define LZ_WINDOW 32768
+#define LZ_HASH_BITS 15
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 258
+#define LZ_MAX_CHAIN 8
+#define LZ_BLOCK_SYMS 32768
+
+#define HUFF_LITLEN 286
+#define HUFF_DIST 30
+#define HUFF_CODELEN 19
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577 };
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t codelen_order[HUFF_CODELEN] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static uint8_t len_code[LZ_MAX_MATCH + 1];  // Match length to code - 257
+static uint8_t dist_code_lo[256];           // Distance - 1 to code
+static uint8_t dist_code_hi[256];           // (Distance - 1) >> 7 to code
+
+static void deflate_init_tables() {
+    for (int c = 0; c < 29; c++) {
+        for (int l = len_base[c]; l < len_base[c] + (1 << len_extra[c]) &&
+                l <= LZ_MAX_MATCH; l++) {
+            len_code[l] = c;
+        }
+    }
+    len_code[LZ_MAX_MATCH] = 28;
+    for (int c = 0; c < 30; c++) {
+        for (int d = dist_base[c]; d < dist_base[c] + (1 << dist_extra[c]); d++) {
+            if (d <= 256) dist_code_lo[d - 1] = c;
+            else dist_code_hi[(d - 1) >> 7] = c;
+        }
+    }
+}
+
+static inline int dist_to_code(int d) {
+    return (d <= 256) ? dist_code_lo[d - 1] : dist_code_hi[(d - 1) >> 7];
+}
+
+// Builds code lengths (at most maxbits) for n symbols with the given
+// frequencies.  Every tree gets at least two codes, so that it is complete.
+static void huff_lengths(uint32_t* freq, int n, int maxbits, uint8_t* lens) {
+    int syms[HUFF_LITLEN], nsyms = 0;
+    for (int i = 0; i < n; i++) {
+        if (freq[i]) syms[nsyms++] = i;
+    }
+    for (int i = 0; nsyms < 2; i++) {
+        if (!freq[i]) {
+            freq[i] = 1;
+            syms[nsyms++] = i;
+        }
+    }
+    memset(lens, 0, n);
+
+    // Huffman's algorithm on a min-heap of node indices.  Leaves are
+    // [0, nsyms); internal nodes follow.
+    uint32_t weight[2 * HUFF_LITLEN];
+    int parent[2 * HUFF_LITLEN];
+    int heap[HUFF_LITLEN], hn = 0;
+    for (int i = 0; i < nsyms; i++) {
+        weight[i] = freq[syms[i]];
+        int k = hn++;
+        while (k > 0 && weight[heap[(k-1)/2]] > weight[i]) {
+            heap[k] = heap[(k-1)/2];
+            k = (k-1)/2;
+        }
+        heap[k] = i;
+    }
+    int next = nsyms;
+    while (hn > 1) {
+        int pair[2];
+        for (int p = 0; p < 2; p++) {
+            pair[p] = heap[0];
+            int last = heap[--hn];
+            int k = 0;
+            while (2*k + 1 < hn) {
+                int c = 2*k + 1;
+                if (c + 1 < hn && weight[heap[c+1]] < weight[heap[c]]) c++;
+                if (weight[heap[c]] >= weight[last]) break;
+                heap[k] = heap[c];
+                k = c;
+            }
+            heap[k] = last;
+        }
+        weight[next] = weight[pair[0]] + weight[pair[1]];
+        parent[pair[0]] = parent[pair[1]] = next;
+        int k = hn++;
+        while (k > 0 && weight[heap[(k-1)/2]] > weight[next]) {
+            heap[k] = heap[(k-1)/2];
+            k = (k-1)/2;
+        }
+        heap[k] = next;
+        next++;
+    }
+
+    // Depths, counted per length.  The root is node next-1.
+    int depth[2 * HUFF_LITLEN];
+    int bl_count[2 * HUFF_LITLEN] = { 0 };
+    depth[next - 1] = 0;
+    for (int i = next - 2; i >= 0; i--) {
+        depth[i] = depth[parent[i]] + 1;
+    }
+    int maxdepth = 0;
+    for (int i = 0; i < nsyms; i++) {
+        bl_count[depth[i]]++;
+        if (depth[i] > maxdepth) maxdepth = depth[i];
+    }
+
+    // Squeeze overlong codes down to maxbits, keeping the tree complete.
+    for (int i = maxdepth; i > maxbits; i--) {
+        while (bl_count[i] > 0) {
+            int j = i - 2;
+            while (bl_count[j] == 0) j--;
+            bl_count[i] -= 2;
+            bl_count[i-1]++;
+            bl_count[j+1] += 2;
+            bl_count[j]--;
+        }
+    }
+
+    // Hand out lengths, shortest to the most frequent symbols.
+    for (int i = 1; i < nsyms; i++) { // Insertion sort by descending freq
+        int s = syms[i], k = i;
+        while (k > 0 && freq[syms[k-1]] < freq[s]) {
+            syms[k] = syms[k-1];
+            k--;
+        }
+        syms[k] = s;
+    }
+    for (int len = 1, i = 0; len <= maxbits; len++) {
+        for (int c = 0; c < bl_count[len]; c++) {
+            lens[syms[i++]] = len;
+        }
+    }
+}
+
+// Canonical codes from lengths, bit-reversed for writing least significant
+// bit first.
+static void huff_codes(const uint8_t* lens, int n, uint16_t* codes) {
+    int bl_count[16] = { 0 };
+    int next_code[16];
+    for (int i = 0; i < n; i++) bl_count[lens[i]]++;
+    bl_count[0] = 0;
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + bl_count[bits-1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!lens[i]) continue;
+        int c = next_code[lens[i]]++;
+        int r = 0;
+        for (int b = 0; b < lens[i]; b++) {
+            r = (r << 1) | ((c >> b) & 1);
+        }
+        codes[i] = r;
+    }
+}
+
+typedef struct {
+    uint16_t litlen[LZ_BLOCK_SYMS]; // Literal byte, or match length
+    uint16_t dist[LZ_BLOCK_SYMS];   // 0 for literals
+    int n;
+} lz_block;
+
+static void deflate_stored(png_buf* o, const uint8_t* data, size_t len, int final) {
+    do {
+        size_t n = MIN(len, 65535);
+        len -= n;
+        png_putbits(o, (final && len == 0) ? 1 : 0, 1);
+        png_putbits(o, 0, 2);
+        png_alignbits(o);
+        uint8_t hdr[4] = { n, n >> 8, ~n, (~n) >> 8 };
+        png_buf_append(o, hdr, 4);
+        png_buf_append(o, data, n);
+        data += n;
+    } while (len);
+}
+
+// Emits the symbols in S (which encode the len raw bytes at data) as one
+// block, either dynamic Huffman or stored, whichever is smaller.
+static void deflate_block(png_buf* o, lz_block* S,
+        const uint8_t* data, size_t len, int final) {
+    uint32_t lfreq[HUFF_LITLEN] = { 0 }, dfreq[HUFF_DIST] = { 0 };
+    for (int i = 0; i < S->n; i++) {
+        if (S->dist[i]) {
+            lfreq[257 + len_code[S->litlen[i]]]++;
+            dfreq[dist_to_code(S->dist[i])]++;
+        } else {
+            lfreq[S->litlen[i]]++;
+        }
+    }
+    lfreq[256] = 1;
+
+    uint8_t llens[HUFF_LITLEN], dlens[HUFF_DIST];
+    uint16_t lcodes[HUFF_LITLEN], dcodes[HUFF_DIST];
+    huff_lengths(lfreq, HUFF_LITLEN, 15, llens);
+    huff_lengths(dfreq, HUFF_DIST, 15, dlens);
+    int hlit = HUFF_LITLEN, hdist = HUFF_DIST;
+    while (hlit > 257 && !llens[hlit-1]) hlit--;
+    while (hdist > 1 && !dlens[hdist-1]) hdist--;
+
+    // Run-length encode the code lengths (symbols 16-18 are repeats).
+    uint8_t all[HUFF_LITLEN + HUFF_DIST];
+    uint8_t rle[HUFF_LITLEN + HUFF_DIST], rle_extra[HUFF_LITLEN + HUFF_DIST];
+    int nall = hlit + hdist, nrle = 0;
+    memcpy(all, llens, hlit);
+    memcpy(all + hlit, dlens, hdist);
+    for (int i = 0; i < nall;) {
+        int run = 1;
+        while (i + run < nall && all[i + run] == all[i]) run++;
+        if (all[i] == 0 && run >= 3) {
+            run = MIN(run, 138);
+            rle[nrle] = (run >= 11) ? 18 : 17;
+            rle_extra[nrle++] = (run >= 11) ? run - 11 : run - 3;
+        } else if (all[i] != 0 && run >= 4) {
+            run = MIN(run, 7);
+            rle[nrle++] = all[i];
+            rle[nrle] = 16;
+            rle_extra[nrle++] = run - 4;
+        } else {
+            run = 1;
+            rle[nrle++] = all[i];
+        }
+        i += run;
+    }
+    uint32_t cfreq[HUFF_CODELEN] = { 0 };
+    for (int i = 0; i < nrle; i++) cfreq[rle[i]]++;
+    uint8_t clens[HUFF_CODELEN];
+    uint16_t ccodes[HUFF_CODELEN];
+    huff_lengths(cfreq, HUFF_CODELEN, 7, clens);
+    int hclen = HUFF_CODELEN;
+    while (hclen > 4 && !clens[codelen_order[hclen-1]]) hclen--;
+
+    // Compare sizes against a stored block.
+    static const uint8_t rle_bits[3] = { 2, 3, 7 };
+    uint64_t bits = 3 + 5 + 5 + 4 + 3 * hclen;
+    for (int i = 0; i < nrle; i++) {
+        bits += clens[rle[i]] + ((rle[i] >= 16) ? rle_bits[rle[i] - 16] : 0);
+    }
+    for (int i = 0; i < HUFF_LITLEN; i++) bits += (uint64_t)lfreq[i] * llens[i];
+    for (int i = 0; i < 29; i++) bits += (uint64_t)lfreq[257 + i] * len_extra[i];
+    for (int i = 0; i < HUFF_DIST; i++) {
+        bits += (uint64_t)dfreq[i] * (dlens[i] + dist_extra[i]);
+    }
+    if (bits / 8 >= len + 5 * (len / 65535 + 1)) {
+        deflate_stored(o, data, len, final);
+        return;
+    }
+
+    huff_codes(llens, HUFF_LITLEN, lcodes);
+    huff_codes(dlens, HUFF_DIST, dcodes);
+    huff_codes(clens, HUFF_CODELEN, ccodes);
+
+    // Header.
+    png_putbits(o, final, 1);
+    png_putbits(o, 2, 2);
+    png_putbits(o, hlit - 257, 5);
+    png_putbits(o, hdist - 1, 5);
+    png_putbits(o, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) png_putbits(o, clens[codelen_order[i]], 3);
+    for (int i = 0; i < nrle; i++) {
+        png_putbits(o, ccodes[rle[i]], clens[rle[i]]);
+        if (rle[i] >= 16) png_putbits(o, rle_extra[i], rle_bits[rle[i] - 16]);
+    }
+
+    // Data.
+    for (int i = 0; i < S->n; i++) {
+        int l = S->litlen[i];
+        if (!S->dist[i]) {
+            png_putbits(o, lcodes[l], llens[l]);
+            continue;
+        }
+        int lc = len_code[l];
+        png_putbits(o, lcodes[257 + lc], llens[257 + lc]);
+        png_putbits(o, l - len_base[lc], len_extra[lc]);
+        int d = S->dist[i];
+        int dc = dist_to_code(d);
+        png_putbits(o, dcodes[dc], dlens[dc]);
+        png_putbits(o, d - dist_base[dc], dist_extra[dc]);
+    }
+    png_putbits(o, lcodes[256], llens[256]);
+}
+
+static inline uint32_t lz_hash(const uint8_t* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Compresses data as raw deflate.  Unless final is set, ends with a sync
+// flush (an empty stored block) so that more deflate data can follow.
+static void deflate_band(png_buf* o, const uint8_t* data, size_t len, int final) {
+    int32_t* head = malloc(sizeof(int32_t) << LZ_HASH_BITS);
+    int32_t* prev = malloc(sizeof(int32_t) * LZ_WINDOW);
+    lz_block* S = malloc(sizeof(lz_block));
+    assert(head && prev && S);
+    memset(head, 0xff, sizeof(int32_t) << LZ_HASH_BITS);
+    S->n = 0;
+
+    size_t block_start = 0;
+    size_t p = 0;
+    while (p < len) {
+        int best = 0, best_dist = 0;
+        if (p + LZ_MIN_MATCH <= len) {
+            uint32_t h = lz_hash(data + p);
+            int32_t cand = head[h];
+            int maxlen = (int)MIN(LZ_MAX_MATCH, len - p);
+            for (int chain = 0; chain < LZ_MAX_CHAIN && cand >= 0; chain++) {
+                if (p - cand > LZ_WINDOW - 1) break;
+                if (data[cand + best] == data[p + best]) {
+                    int l = 0;
+                    while (l < maxlen && data[cand + l] == data[p + l]) l++;
+                    if (l > best) {
+                        best = l;
+                        best_dist = (int)(p - cand);
+                        if (l == maxlen) break;
+                    }
+                }
+                int32_t next = prev[cand & (LZ_WINDOW - 1)];
+                if (next >= cand) break;
+                cand = next;
+            }
+        }
+
+        int step = (best >= LZ_MIN_MATCH) ? best : 1;
+        if (best >= LZ_MIN_MATCH) {
+            S->litlen[S->n] = best;
+            S->dist[S->n++] = best_dist;
+        } else {
+            S->litlen[S->n] = data[p];
+            S->dist[S->n++] = 0;
+        }
+
+        // Add every covered position to the hash chains.
+        for (size_t q = p; q < p + step; q++) {
+            if (q + LZ_MIN_MATCH > len) break;
+            uint32_t h = lz_hash(data + q);
+            prev[q & (LZ_WINDOW - 1)] = head[h];
+            head[h] = (int32_t)q;
+        }
+        p += step;
+
+        if (S->n == LZ_BLOCK_SYMS) {
+            deflate_block(o, S, data + block_start, p - block_start, 0);
+            block_start = p;
+            S->n = 0;
+        }
+    }
+    if (S->n || final) {
+        deflate_block(o, S, data + block_start, len - block_start, final);
+    }
+
+    if (final) {
+        png_alignbits(o);
+    } else {
+        deflate_stored(o, NULL, 0, 0);
+    }
+
+    free(head);
+    free(prev);
+    free(S);
+}
+
+#else /* PNG_USE_ZLIB */
+
+static void deflate_init_tables() {
+}
+
+static void deflate_band(png_buf* o, const uint8_t* data, size_t len, int final) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+        abort(); // Out of memory
+    }
+    png_buf_reserve(o, deflateBound(&z, len) + 16);
+    z.next_in = (uint8_t*)data;
+    z.avail_in = len;
+    z.next_out = o->buf + o->len;
+    z.avail_out = o->cap - o->len;
+    // The output has room for deflateBound() bytes, so one call finishes.
+    int ret = deflate(&z, final ? Z_FINISH : Z_SYNC_FLUSH);
+    if (ret != (final ? Z_STREAM_END : Z_OK)) abort();
+    o->len = o->cap - z.avail_out;
+    deflateEnd(&z);
+}
+
+#endif /* PNG_USE_ZLIB */
+
+////////////////////////////////////////////////////////////////////////////////
+// PNG /////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return (pb <= pc) ? b : c;
+}
+
+// Sum of filtered bytes taken as signed, the usual heuristic for choosing a
+// filter.
+static inline uint32_t filter_cost(const uint8_t* f, int n) {
+    uint32_t cost = 0;
+    for (int i = 0; i < n; i++) cost += abs((int8_t)f[i]);
+    return cost;
+}
+
+// Filters one RGB row (cur) given the row above it (prev, or NULL) into out:
+// a filter type byte followed by n bytes.  scratch holds 5 * n bytes.
+static void png_filter_row(const uint8_t* cur, const uint8_t* prev, int n,
+        uint8_t* scratch, uint8_t* out) {
+    uint8_t* f[5];
+    for (int t = 0; t < 5; t++) f[t] = scratch + (size_t)t * n;
+    for (int i = 0; i < n; i++) {
+        int a = (i >= 3) ? cur[i-3] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = (prev && i >= 3) ? prev[i-3] : 0;
+        f[0][i] = cur[i];
+        f[1][i] = cur[i] - a;
+        f[2][i] = cur[i] - b;
+        f[3][i] = cur[i] - ((a + b) >> 1);
+        f[4][i] = cur[i] - paeth(a, b, c);
+    }
+
+    int best = 0;
+    uint32_t best_cost = filter_cost(f[0], n);
+    for (int t = 1; t < 5; t++) {
+        uint32_t cost = filter_cost(f[t], n);
+        if (cost < best_cost) {
+            best = t;
+            best_cost = cost;
+        }
+    }
+    out[0] = best;
+    memcpy(out + 1, f[best], n);
+}
+
+typedef struct {
+    BitmapImage* B;
+    int rows_per_band;
+    int nbands;
+    png_buf* out;       // One IDAT chunk per band
+    uint32_t* adler;    // Adler-32 of each band's filtered data
+    size_t* rawlen;     // Length of each band's filtered data
+} png_job;
+
+// Copies PNG row k (counted from the top of the PNG) into rgb.
+static void png_get_row(BitmapImage* B, int k, uint8_t* rgb) {
+    const BitmapPixel* P = PTR_BYTE_ADD(B->raw,
+            (size_t)ROWWIDTH(B->width) * (B->height - 1 - k));
+    for (int x = 0; x < B->width; x++) {
+        rgb[3*x + 0] = P[x].r;
+        rgb[3*x + 1] = P[x].g;
+        rgb[3*x + 2] = P[x].b;
+    }
+}
+
+static void png_band(void* arg, int band) {
+    png_job* J = arg;
+    BitmapImage* B = J->B;
+    int n = B->width * 3;
+    int k0 = band * J->rows_per_band;
+    int k1 = MIN(k0 + J->rows_per_band, B->height);
+
+    // Filter the rows.  The row above the band is needed too.
+    size_t rawlen = (size_t)(k1 - k0) * (n + 1);
+    uint8_t* raw = malloc(rawlen);
+    uint8_t* rows = malloc((size_t)n * 7);
+    assert(raw && rows);
+    uint8_t* cur = rows;
+    uint8_t* prev = rows + n;
+    uint8_t* scratch = rows + 2 * n;
+    if (k0 > 0) png_get_row(B, k0 - 1, prev);
+    for (int k = k0; k < k1; k++) {
+        png_get_row(B, k, cur);
+        png_filter_row(cur, (k > 0) ? prev : NULL, n, scratch,
+                raw + (size_t)(k - k0) * (n + 1));
+        uint8_t* tmp = cur;
+        cur = prev;
+        prev = tmp;
+    }
+    J->adler[band] = png_adler(1, raw, rawlen);
+    J->rawlen[band] = rawlen;
+
+    // Compress into an IDAT chunk.  The first band carries the zlib header.
+    png_buf* o = &J->out[band];
+    memset(o, 0, sizeof(png_buf));
+    png_buf_be32(o, 0); // Length, filled in below
+    png_buf_append(o, "IDAT", 4);
+    if (band == 0) {
+        uint8_t zhdr[2] = { 0x78, 0x01 };
+        png_buf_append(o, zhdr, 2);
+    }
+    deflate_band(o, raw, rawlen, band == J->nbands - 1);
+    uint32_t len = o->len - 8;
+    o->buf[0] = len >> 24;
+    o->buf[1] = len >> 16;
+    o->buf[2] = len >> 8;
+    o->buf[3] = len;
+    png_buf_be32(o, png_crc(0, o->buf + 4, o->len - 4));
+
+    free(raw);
+    free(rows);
+}
+
+static void png_chunk(png_buf* o, const char* type, const uint8_t* data, uint32_t len) {
+    png_buf_be32(o, len);
+    size_t start = o->len;
+    png_buf_append(o, type, 4);
+    png_buf_append(o, data, len);
+    png_buf_be32(o, png_crc(0, o->buf + start, len + 4));
+}
+
+static pthread_once_t png_tables_once = PTHREAD_ONCE_INIT;
+
+static void png_init_tables() {
+    png_crc_init();
+    deflate_init_tables();
+}
+
+void bmp_write_png(const char* filename, BitmapImage* B) {
+    // Built on first use; once written, the tables are only read.
+    pthread_once(&png_tables_once, &png_init_tables);
+
+    // Split into bands and compress them all.
+    png_job J;
+    J.B = B;
+    J.rows_per_band = PNG_BAND_BYTES / (B->width * 3 + 1);
+    if (J.rows_per_band < 1) J.rows_per_band = 1;
+    J.nbands = (B->height + J.rows_per_band - 1) / J.rows_per_band;
+    J.out = malloc(sizeof(png_buf) * J.nbands);
+    J.adler = malloc(sizeof(uint32_t) * J.nbands);
+    J.rawlen = malloc(sizeof(size_t) * J.nbands);
+    assert(J.out && J.adler && J.rawlen);
+    par_for(J.nbands, &png_band, &J);
+
+    // Signature and header.
+    png_buf head = { 0 };
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    png_buf_append(&head, sig, 8);
+    uint8_t ihdr[13] = {
+        B->width >> 24, B->width >> 16, B->width >> 8, B->width,
+        B->height >> 24, B->height >> 16, B->height >> 8, B->height,
+        8,  // Bit depth
+        2,  // Color type: RGB
+        0, 0, 0 }; // Deflate, adaptive filtering, no interlace
+    png_chunk(&head, "IHDR", ihdr, 13);
+
+    // The zlib trailer: Adler-32 of all of the filtered data.
+    png_buf tail = { 0 };
+    uint32_t adler = J.adler[0];
+    for (int i = 1; i < J.nbands; i++) {
+        adler = png_adler_combine(adler, J.adler[i], J.rawlen[i]);
+    }
+    uint8_t trailer[4] = { adler >> 24, adler >> 16, adler >> 8, adler };
+    png_chunk(&tail, "IDAT", trailer, 4);
+    png_chunk(&tail, "IEND", NULL, 0);
+
+    // Write out.
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IROTH);
+    assert(fd >= 0);
+    bmp_write_all(fd, head.buf, head.len);
+    for (int i = 0; i < J.nbands; i++) {
+        bmp_write_all(fd, J.out[i].buf, J.out[i].len);
+        free(J.out[i].buf);
+    }
+    bmp_write_all(fd, tail.buf, tail.len);
+    assert(close(fd) == 0);
+
+    free(head.buf);
+    free(tail.buf);
+    free(J.out);
+    free(J.adler);
+    free(J.rawlen);
+}
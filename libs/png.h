@@ -0,0 +1,19 @@
+#ifndef _PNG_H_
+#define _PNG_H_
+
+#include "bmp_base.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// PNG output //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Writes an in-memory bitmap out as a 24-bit PNG.  Rows are written in the
+// order a viewer shows the equivalent BMP, so both files look the same.
+//
+// The image is cut into bands of rows that are filtered and compressed
+// independently on par_nthreads() threads, then joined into a single zlib
+// stream (each band ends on a sync flush, as pigz does).  Compression uses a
+// built-in deflate encoder; define PNG_USE_ZLIB (and link -lz) to use zlib's
+// instead.
+void bmp_write_png(const char* filename, BitmapImage* B);
+
+#endif /* _PNG_H_ */
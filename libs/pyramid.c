@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "pyramid.h"
+
+#define PAD_TO(size, align) ((((((size)-1) / align)+1) * align))
+#define PTR_BYTE_ADD(p, x) ((void*)(((char*)(p))+(x)))
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define ROWWIDTH(width) (PAD_TO((width)*sizeof(BitmapPixel), 4))
+
+////////////////////////////////////////////////////////////////////////////////
+// Pyramid levels //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int level;          // Deep Zoom level number
+    int width, height;
+    int y;              // Rows received so far
+    BitmapPixel* band;  // Up to tilesize rows waiting to be cut into tiles
+    int band_rows;
+    BitmapPixel* pending; // Even row waiting for its odd partner
+    int has_pending;
+} pyramid_level;
+
+typedef struct {
+    const char* dir;
+    int tilesize;
+    int nlevels;
+    pyramid_level* levels; // Index 0 is full size
+} pyramid_t;
+
+// 2x2 box filter of rows a and b (each w pixels) into out ((w+1)/2 pixels).
+//
+// Four output pixels at a time: the 24 bytes they come from are loaded from
+// each row as two overlapping 16-byte vectors and widened to 16 bits, the rows
+// added, and a shuffle lines each byte up with the same channel of its right
+// hand neighbor.  Leftover pixels go through the scalar loop.
+typedef uint8_t pyramid_u8x16 __attribute__((vector_size(16)));
+typedef uint16_t pyramid_u16x16 __attribute__((vector_size(32)));
+
+static inline __attribute__((always_inline)) void pyramid_downsample_body(
+        const BitmapPixel* a, const BitmapPixel* b, int w, BitmapPixel* out) {
+    const uint8_t* pa = (const uint8_t*)a;
+    const uint8_t* pb = (const uint8_t*)b;
+    uint8_t* po = (uint8_t*)out;
+
+    // Byte k (< 24) of the block is lane k of lo for k < 16, else lane k-8
+    // of hi, which is lane k+8 of the pair (lo, hi).
+    static const pyramid_u16x16 left = {
+        0, 1, 2, 6, 7, 8, 12, 13, 14, 26, 27, 28, 0, 0, 0, 0 };
+    static const pyramid_u16x16 right = {
+        3, 4, 5, 9, 10, 11, 15, 24, 25, 29, 30, 31, 0, 0, 0, 0 };
+    const pyramid_u16x16 round = {
+        2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 };
+
+    int half = w / 2, i = 0;
+    for (; i + 4 <= half; i += 4) {
+        pyramid_u8x16 a0, a1, b0, b1;
+        memcpy(&a0, pa + 6*i, 16);
+        memcpy(&a1, pa + 6*i + 8, 16);
+        memcpy(&b0, pb + 6*i, 16);
+        memcpy(&b1, pb + 6*i + 8, 16);
+        pyramid_u16x16 lo = __builtin_convertvector(a0, pyramid_u16x16) +
+                __builtin_convertvector(b0, pyramid_u16x16);
+        pyramid_u16x16 hi = __builtin_convertvector(a1, pyramid_u16x16) +
+                __builtin_convertvector(b1, pyramid_u16x16);
+        pyramid_u16x16 sum = __builtin_shuffle(lo, hi, left) +
+                __builtin_shuffle(lo, hi, right) + round;
+        pyramid_u8x16 px = __builtin_convertvector(sum >> 2, pyramid_u8x16);
+        memcpy(po + 3*i, &px, 12);
+    }
+    for (; i < half; i++) {
+        for (int c = 0; c < 3; c++) {
+            po[3*i + c] = (uint8_t)((pa[6*i + c] + pb[6*i + c] +
+                    pa[6*i + 3 + c] + pb[6*i + 3 + c] + 2) >> 2);
+        }
+    }
+    if (w & 1) { // Last column pairs with itself
+        for (int c = 0; c < 3; c++) {
+            po[3*half + c] = (uint8_t)((2 * (pa[3*(w-1) + c] + pb[3*(w-1) + c]) + 2) >> 2);
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void pyramid_downsample_avx2(const BitmapPixel* a, const BitmapPixel* b,
+        int w, BitmapPixel* out) {
+    pyramid_downsample_body(a, b, w, out);
+}
+#endif
+
+static void pyramid_downsample(const BitmapPixel* a, const BitmapPixel* b,
+        int w, BitmapPixel* out) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        pyramid_downsample_avx2(a, b, w, out);
+        return;
+    }
+#endif
+    pyramid_downsample_body(a, b, w, out);
+}
+
+// Writes the current band of a level out as one row of tiles.
+static void pyramid_flush_band(pyramid_t* P, pyramid_level* L) {
+    if (L->band_rows == 0) return;
+
+    char path[PATH_MAX];
+    int tile_row = (L->y - 1) / P->tilesize;
+    for (int tx = 0; tx * P->tilesize < L->width; tx++) {
+        int x0 = tx * P->tilesize;
+        int tw = MIN(P->tilesize, L->width - x0);
+        BitmapImage* T = bmp_create(tw, L->band_rows);
+        for (int r = 0; r < L->band_rows; r++) { // BMP rows go bottom up
+            memcpy(PTR_BYTE_ADD(T->raw, ROWWIDTH(tw) * (L->band_rows - 1 - r)),
+                    &L->band[(size_t)r * L->width + x0],
+                    sizeof(BitmapPixel) * tw);
+        }
+        snprintf(path, sizeof(path), "%s/%d/%d_%d.bmp",
+                P->dir, L->level, tx, tile_row);
+        bmp_write(path, T);
+        bmp_free(T);
+    }
+    L->band_rows = 0;
+}
+
+// Feeds one row into level k, cascading down to coarser levels.
+static void pyramid_push_row(pyramid_t* P, int k, const BitmapPixel* row) {
+    pyramid_level* L = &P->levels[k];
+    assert(L->y < L->height);
+
+    memcpy(&L->band[(size_t)L->band_rows * L->width], row,
+            sizeof(BitmapPixel) * L->width);
+    L->band_rows++;
+    L->y++;
+
+    // Pair rows off for the next level down.
+    if (k + 1 < P->nlevels) {
+        pyramid_level* N = &P->levels[k+1];
+        if (L->has_pending) {
+            BitmapPixel* down = N->pending + N->width; // Scratch row
+            pyramid_downsample(L->pending, row, L->width, down);
+            L->has_pending = 0;
+            pyramid_push_row(P, k + 1, down);
+        } else if (L->y == L->height) { // Last row pairs with itself
+            BitmapPixel* down = N->pending + N->width;
+            pyramid_downsample(row, row, L->width, down);
+            pyramid_push_row(P, k + 1, down);
+        } else {
+            memcpy(L->pending, row, sizeof(BitmapPixel) * L->width);
+            L->has_pending = 1;
+        }
+    }
+
+    if (L->band_rows == P->tilesize || L->y == L->height) {
+        pyramid_flush_band(P, L);
+    }
+}
+
+void pyramid_write_stream(const char* dir, int width, int height, int tilesize,
+        PyramidRowFn fill, void* arg) {
+    assert(width > 0 && height > 0 && tilesize > 0);
+
+    // Count levels: halve (rounding up) until 1x1.
+    int nlevels = 1;
+    for (int w = width, h = height; w > 1 || h > 1; nlevels++) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    pyramid_t P;
+    P.dir = dir;
+    P.tilesize = tilesize;
+    P.nlevels = nlevels;
+    P.levels = calloc(sizeof(pyramid_level), nlevels);
+    assert(P.levels);
+
+    char path[PATH_MAX];
+    mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+    for (int k = 0, w = width, h = height; k < nlevels; k++) {
+        pyramid_level* L = &P.levels[k];
+        L->level = nlevels - 1 - k;
+        L->width = w;
+        L->height = h;
+        L->band = malloc(sizeof(BitmapPixel) * (size_t)w * tilesize);
+        // Pending row plus a scratch row for whatever the level above
+        // downsamples into this one.
+        L->pending = malloc(sizeof(BitmapPixel) * (size_t)w * 2);
+        assert(L->band && L->pending);
+        snprintf(path, sizeof(path), "%s/%d", dir, L->level);
+        mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    // Stream the source in bands.
+    BitmapPixel* rows = malloc(sizeof(BitmapPixel) * (size_t)width * tilesize);
+    assert(rows);
+    for (int y = 0; y < height; y += tilesize) {
+        int n = MIN(tilesize, height - y);
+        fill(arg, y, n, rows);
+        for (int r = 0; r < n; r++) {
+            pyramid_push_row(&P, 0, &rows[(size_t)r * width]);
+        }
+    }
+
+    // Every level has now seen all of its rows (and flushed its last band).
+    for (int k = 0; k < nlevels; k++) {
+        assert(P.levels[k].y == P.levels[k].height);
+        free(P.levels[k].band);
+        free(P.levels[k].pending);
+    }
+    free(P.levels);
+    free(rows);
+}
+
+// Rows are counted from the top, and BMP rows are stored bottom up.
+static void pyramid_fill_bitmap(void* arg, int y, int n, BitmapPixel* rows) {
+    BitmapImage* B = arg;
+    for (int r = 0; r < n; r++) {
+        memcpy(&rows[(size_t)r * B->width],
+                PTR_BYTE_ADD(B->raw,
+                    (size_t)ROWWIDTH(B->width) * (B->height - 1 - (y + r))),
+                sizeof(BitmapPixel) * B->width);
+    }
+}
+
+void bmp_write_pyramid(const char* dir, BitmapImage* B, int tilesize) {
+    pyramid_write_stream(dir, B->width, B->height, tilesize,
+            &pyramid_fill_bitmap, B);
+}
@@ -0,0 +1,31 @@
+#ifndef _PYRAMID_H_
+#define _PYRAMID_H_
+
+#include <stdint.h>
+#include "bmp_base.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Tile pyramids ///////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Export an image as a Deep Zoom style pyramid of tiles.  Level L holds the
+// image scaled down by 2^(top-L), where top = ceil(log2(max(width, height)));
+// level top is full size and level 0 is a single pixel.  Tiles are
+// tilesize x tilesize BMPs (smaller on the right and bottom edges), written to
+// dir/<level>/<column>_<row>.bmp.
+//
+// The source is read once, top row first, and every coarser level is built
+// from the one above with a 2x2 box filter as rows arrive.  Only one band of
+// tilesize rows per level is held in memory at a time.
+
+// Fills rows [y, y+n) of the source, counted from the top, into rows, packed
+// one after the other with no row padding.
+typedef void (*PyramidRowFn)(void* arg, int y, int n, BitmapPixel* rows);
+
+// Export an in-memory bitmap.
+void bmp_write_pyramid(const char* dir, BitmapImage* B, int tilesize);
+
+// Export a width x height image produced band by band by fill.
+void pyramid_write_stream(const char* dir, int width, int height, int tilesize,
+        PyramidRowFn fill, void* arg);
+
+#endif /* _PYRAMID_H_ */
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "bmp.h"
+#include "noise.h"
+
+int main(int argc, char* argv[]) {
+    // Set up
+    int width = 1080;
+    int height = 1080;
+    BitmapImage* B = bmp_create(width, height);
+
+    // Cloud-like fBm with 6 octaves
+    DrawFn* fbm = DrawFn_init_fbm(0, 0, 256.0, 6, 2.0, 0.5, (uint32_t)clock(),
+            32, 64, 160,
+            255, 255, 255);
+
+    // Write noise pattern to image
+    bmp_drawrect(B, 0, 0, width, height, fbm);
+
+    // Write image
+    bmp_write("noise.bmp", B);
+
+    // Cell outlines from Worley noise
+    DrawFn* worley = DrawFn_init_worley(0, 0, 64.0, 1.0,
+            WORLEY_F2_F1, WORLEY_EUCLIDEAN, (uint32_t)clock(),
+            16, 16, 32,
+            224, 240, 255);
+    bmp_drawrect(B, 0, 0, width, height, worley);
+    bmp_write("worley.bmp", B);
+
+    // Clean up
+    DrawFn_free(worley);
+    DrawFn_free(fbm);
+    bmp_free(B);
+    return 0;
+}
@@ -0,0 +1,339 @@
+//
+// Procedural noise shaders.  Unlike the diamond-square cloud fractal, these are
+// evaluated directly from a hash of the lattice coordinates, so they need no
+// precomputed storage and can be sampled anywhere on the plane.
+//
+// Shaders are evaluated a span at a time, NOISE_LANES pixels per block.  The
+// per-block loops are branch-free over fixed-size arrays so that the compiler
+// can vectorize the lattice hashing and interpolation.
+//
+// (https://en.wikipedia.org/wiki/Perlin_noise)
+// (https://en.wikipedia.org/wiki/Fractional_Brownian_motion)
+// (https://en.wikipedia.org/wiki/Worley_noise)
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include "bmp.h"
+#include "noise.h"
+
+#define NOISE_LANES 8
+#define CLAMP01(f) ((f) < 0.0f ? 0.0f : ((f) > 1.0f ? 1.0f : (f)))
+
+////////////////////////////////////////////////////////////////////////////////
+// Lattice helpers /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Hashes a lattice point to 32 pseudorandom bits.
+static inline uint32_t lattice_hash(int32_t x, int32_t y, uint32_t seed) {
+    uint32_t h = seed;
+    h ^= (uint32_t)x * 0x8da6b343u;
+    h ^= (uint32_t)y * 0xd8163841u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    h *= 0x297a2d39u;
+    h ^= h >> 15;
+    return h;
+}
+
+// Dot product of (x, y) with one of eight gradient directions chosen by h.
+static inline float lattice_grad(uint32_t h, float x, float y) {
+    float u = (h & 4) ? y : x;
+    float v = (h & 4) ? x : y;
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+// Quintic fade curve, so noise has continuous first and second derivatives.
+static inline float fade(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline int32_t ifloor(double f) {
+    int32_t i = (int32_t)f;
+    return i - (f < i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fractal Brownian motion /////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    double scale;
+    double lacunarity;
+    double gain;
+    int octaves;
+    uint32_t seed;
+} fbm_t;
+
+// Accumulates one octave of gradient noise for NOISE_LANES consecutive
+// samples.  Sample k is at (bx + fx0 + k*step, by + fy) in lattice units, where
+// bx and by are integers and fx0, fy are on [0, 1).
+static inline void fbm_octave(float* out, float amp,
+        int32_t bx, float fx0, float step,
+        int32_t by, float fy, uint32_t seed) {
+    int32_t xi[NOISE_LANES];
+    float tx[NOISE_LANES];
+    float ty = fy;
+    float v = fade(ty);
+
+    for (int k = 0; k < NOISE_LANES; k++) {
+        float fx = fx0 + k * step;
+        int32_t ix = (int32_t)fx;
+        tx[k] = fx - ix;
+        xi[k] = bx + ix;
+    }
+
+    for (int k = 0; k < NOISE_LANES; k++) {
+        uint32_t h00 = lattice_hash(xi[k],     by,     seed);
+        uint32_t h10 = lattice_hash(xi[k] + 1, by,     seed);
+        uint32_t h01 = lattice_hash(xi[k],     by + 1, seed);
+        uint32_t h11 = lattice_hash(xi[k] + 1, by + 1, seed);
+        float g00 = lattice_grad(h00, tx[k],        ty);
+        float g10 = lattice_grad(h10, tx[k] - 1.0f, ty);
+        float g01 = lattice_grad(h01, tx[k],        ty - 1.0f);
+        float g11 = lattice_grad(h11, tx[k] - 1.0f, ty - 1.0f);
+        float u = fade(tx[k]);
+        float n0 = g00 + u * (g10 - g00);
+        float n1 = g01 + u * (g11 - g01);
+        out[k] += amp * (n0 + v * (n1 - n0));
+    }
+}
+
+// Evaluates fBm on [0, 1] for NOISE_LANES pixels starting at (x, y), relative
+// to the noise origin.
+static void fbm_block(fbm_t* F, double x, double y, float* out) {
+    double freq = 1.0 / F->scale;
+    float amp = 1.0f;
+    float amp_total = 0.0f;
+
+    for (int k = 0; k < NOISE_LANES; k++) out[k] = 0.0f;
+
+    for (int o = 0; o < F->octaves; o++) {
+        // Split off the integer lattice coordinates in double precision so
+        // that the per-lane float math stays accurate far from the origin.
+        double px = x * freq, py = y * freq;
+        int32_t bx = ifloor(px), by = ifloor(py);
+        fbm_octave(out, amp, bx, (float)(px - bx), (float)freq,
+                by, (float)(py - by), F->seed + o * 0x9e3779b9u);
+        amp_total += amp;
+        amp *= F->gain;
+        freq *= F->lacunarity;
+    }
+
+    // Gradient noise is roughly on [-1, 1]; map to [0, 1].
+    float norm = (amp_total > 0.0f) ? 0.5f / amp_total : 0.0f;
+    for (int k = 0; k < NOISE_LANES; k++) {
+        float f = 0.5f + out[k] * norm;
+        out[k] = CLAMP01(f);
+    }
+}
+
+void DrawFn_drawspan_fbm(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    fbm_t* F = d->mem;
+    BitmapPixel* P = bmp_pixelptr(B, x, y);
+    float intensity[NOISE_LANES];
+    int rdiff = (int)d->r2 - (int)d->r1;
+    int gdiff = (int)d->g2 - (int)d->g1;
+    int bdiff = (int)d->b2 - (int)d->b1;
+
+    for (unsigned int i = 0; i < len; i += NOISE_LANES) {
+        fbm_block(F, (double)(x + i) - d->x1, (double)y - d->y1, intensity);
+        unsigned int n = (len - i < NOISE_LANES) ? len - i : NOISE_LANES;
+        for (unsigned int k = 0; k < n; k++) {
+            float t = intensity[k];
+            P[i+k].r = (uint8_t)(d->r1 + (int)(rdiff * t));
+            P[i+k].g = (uint8_t)(d->g1 + (int)(gdiff * t));
+            P[i+k].b = (uint8_t)(d->b1 + (int)(bdiff * t));
+        }
+    }
+}
+
+void DrawFn_drawpx_fbm(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    DrawFn_drawspan_fbm(B, d, x, y, 1);
+}
+
+void DrawFn_free_fbm(DrawFn* d) {
+    free(d->mem);
+}
+
+DrawFn* DrawFn_init_fbm(int x, int y, double scale,
+        int octaves, double lacunarity, double gain, uint32_t seed,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    assert(scale > 0.0);
+    assert(octaves > 0);
+
+    // Initialize memory
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    fbm_t* F = malloc(sizeof(fbm_t));
+    assert(F);
+
+    // Initialize functions
+    d->pxfn = &DrawFn_drawpx_fbm;
+    d->spanfn = &DrawFn_drawspan_fbm;
+    d->coverage = COVER_PAINT;
+    d->freefn = &DrawFn_free_fbm;
+
+    // Initialize other members.  Use x1, y1 to store the noise origin.
+    F->scale = scale;
+    F->lacunarity = lacunarity;
+    F->gain = gain;
+    F->octaves = octaves;
+    F->seed = seed;
+    d->mem = F;
+    d->x1 = x;
+    d->y1 = y;
+    d->r1 = r1;
+    d->g1 = g1;
+    d->b1 = b1;
+    d->r2 = r2;
+    d->g2 = g2;
+    d->b2 = b2;
+    return d;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Worley noise ////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    double scale;
+    double jitter;
+    WorleyOutput output;
+    WorleyMetric metric;
+    uint32_t seed;
+} worley_t;
+
+// The feature point of cell (cx, cy), in lattice units.
+static inline void worley_point(worley_t* W, int32_t cx, int32_t cy,
+        double* fx, double* fy) {
+    uint32_t h = lattice_hash(cx, cy, W->seed);
+    *fx = cx + 0.5 + W->jitter * ((h & 0xffff) / 65536.0 - 0.5);
+    *fy = cy + 0.5 + W->jitter * ((h >> 16) / 65536.0 - 0.5);
+}
+
+static inline double worley_distance(WorleyMetric metric, double dx, double dy) {
+    dx = fabs(dx);
+    dy = fabs(dy);
+    switch (metric) {
+    case WORLEY_MANHATTAN:
+        return dx + dy;
+    case WORLEY_CHEBYSHEV:
+        return (dx > dy) ? dx : dy;
+    default:
+        return sqrt(dx * dx + dy * dy);
+    }
+}
+
+void DrawFn_drawspan_worley(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y, unsigned int len) {
+    worley_t* W = d->mem;
+    BitmapPixel* P = bmp_pixelptr(B, x, y);
+    int rdiff = (int)d->r2 - (int)d->r1;
+    int gdiff = (int)d->g2 - (int)d->g1;
+    int bdiff = (int)d->b2 - (int)d->b1;
+
+    // Feature points of the 3x3 cells around the current one.  A span stays in
+    // one row of cells, so these only change when it crosses into the next
+    // column of cells.
+    double py = ((double)y - d->y1) / W->scale;
+    int32_t cy = ifloor(py);
+    double fx[9], fy[9];
+    int32_t cached = 0;
+    int have = 0;
+
+    for (unsigned int i = 0; i < len; i++) {
+        double px = ((double)(x + i) - d->x1) / W->scale;
+        int32_t cx = ifloor(px);
+        if (!have || cx != cached) {
+            for (int k = 0; k < 9; k++) {
+                worley_point(W, cx + k % 3 - 1, cy + k / 3 - 1, &fx[k], &fy[k]);
+            }
+            cached = cx;
+            have = 1;
+        }
+
+        // Nearest two distances.
+        double f1 = INFINITY, f2 = INFINITY;
+        for (int k = 0; k < 9; k++) {
+            double dist = worley_distance(W->metric, fx[k] - px, fy[k] - py);
+            if (dist < f1) {
+                f2 = f1;
+                f1 = dist;
+            } else if (dist < f2) {
+                f2 = dist;
+            }
+        }
+
+        double v;
+        switch (W->output) {
+        case WORLEY_F2:
+            v = 0.5 * f2;
+            break;
+        case WORLEY_F2_F1:
+            v = f2 - f1;
+            break;
+        default:
+            v = f1;
+            break;
+        }
+        float t = (float)v;
+        t = CLAMP01(t);
+        P[i].r = (uint8_t)(d->r1 + (int)(rdiff * t));
+        P[i].g = (uint8_t)(d->g1 + (int)(gdiff * t));
+        P[i].b = (uint8_t)(d->b1 + (int)(bdiff * t));
+    }
+}
+
+void DrawFn_drawpx_worley(BitmapImage* B, DrawFn* d,
+        unsigned int x, unsigned int y) {
+    DrawFn_drawspan_worley(B, d, x, y, 1);
+}
+
+void DrawFn_free_worley(DrawFn* d) {
+    free(d->mem);
+}
+
+DrawFn* DrawFn_init_worley(int x, int y, double scale, double jitter,
+        WorleyOutput output, WorleyMetric metric, uint32_t seed,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2) {
+    assert(scale > 0.0);
+    assert(jitter >= 0.0 && jitter <= 1.0);
+
+    // Initialize memory
+    DrawFn* d = malloc(sizeof(DrawFn));
+    assert(d);
+    worley_t* W = malloc(sizeof(worley_t));
+    assert(W);
+
+    // Initialize functions
+    d->pxfn = &DrawFn_drawpx_worley;
+    d->spanfn = &DrawFn_drawspan_worley;
+    d->coverage = COVER_PAINT;
+    d->freefn = &DrawFn_free_worley;
+
+    // Initialize other members.  Use x1, y1 to store the grid origin.
+    W->scale = scale;
+    W->jitter = jitter;
+    W->output = output;
+    W->metric = metric;
+    W->seed = seed;
+    d->mem = W;
+    d->x1 = x;
+    d->y1 = y;
+    d->r1 = r1;
+    d->g1 = g1;
+    d->b1 = b1;
+    d->r2 = r2;
+    d->g2 = g2;
+    d->b2 = b2;
+    return d;
+}
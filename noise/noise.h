@@ -0,0 +1,50 @@
+#ifndef _NOISE_H_
+#define _NOISE_H_
+
+#include <stdint.h>
+#include "bmp.h"
+
+// Draw a fractal Brownian motion (fBm) pattern built from octaves of gradient
+// (Perlin) noise.  Nothing is precomputed, so any region of the plane can be
+// sampled at any resolution.
+//
+// * (x, y) is the pixel that maps to the origin of the noise plane.
+// * scale is the size (in pixels) of one lattice cell of the first octave.
+// * Each octave multiplies frequency by lacunarity and amplitude by gain.
+//   Typical values are 2.0 and 0.5.
+// * The pattern is blended from (r1, g1, b1) at the lowest values to
+//   (r2, g2, b2) at the highest.
+DrawFn* DrawFn_init_fbm(int x, int y, double scale,
+        int octaves, double lacunarity, double gain, uint32_t seed,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2);
+
+typedef enum {
+    WORLEY_F1,      // Distance to the nearest feature point
+    WORLEY_F2,      // Distance to the second nearest
+    WORLEY_F2_F1    // Difference of the two; outlines the cells
+} WorleyOutput;
+
+typedef enum {
+    WORLEY_EUCLIDEAN,
+    WORLEY_MANHATTAN,
+    WORLEY_CHEBYSHEV
+} WorleyMetric;
+
+// Draw Worley (cellular) noise.  The plane is cut into square cells with one
+// randomly placed feature point each, and pixels are shaded by their distance
+// to the nearest points.  Only the 3x3 block of cells around a pixel is
+// searched, so the cost per pixel doesn't depend on how many cells there are.
+//
+// * (x, y) is the pixel that maps to the origin of the cell grid.
+// * scale is the size (in pixels) of one cell.
+// * jitter (on [0, 1]) is how far points stray from the centers of their
+//   cells; 0 gives a regular grid.
+// * Distances are measured in cells and clamped to [0, 1] (F2 is halved
+//   first), then blended from (r1, g1, b1) to (r2, g2, b2).
+DrawFn* DrawFn_init_worley(int x, int y, double scale, double jitter,
+        WorleyOutput output, WorleyMetric metric, uint32_t seed,
+        uint8_t r1, uint8_t g1, uint8_t b1,
+        uint8_t r2, uint8_t g2, uint8_t b2);
+
+#endif /* _NOISE_H_ */
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "bmp.h"
+#include "lsystem.h"
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+
+#define LSYS_BATCH 1024     // Segments per call to bmp_drawpolygons
+#define LSYS_MAXPERIOD 360  // Largest number of turns kept in a table
+
+////////////////////////////////////////////////////////////////////////////////
+// Presets /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static const LsysRule lsys_dragon_rules[] = {
+    { 'X', "X+YF+" },
+    { 'Y', "-FX-Y" },
+};
+
+static const LsysRule lsys_hilbert_rules[] = {
+    { 'A', "+BF-AFA-FB+" },
+    { 'B', "-AF+BFB+FA-" },
+};
+
+static const LsysRule lsys_gosper_rules[] = {
+    { 'A', "A-B--B+A++AA+B-" },
+    { 'B', "+A-BB--B-A++A+B" },
+};
+
+static const LsysRule lsys_plant_rules[] = {
+    { 'X', "F+[[X]-X]-F[-FX]+X" },
+    { 'F', "FF" },
+};
+
+const LSystem lsys_dragon  = { "FX", lsys_dragon_rules,  2, 90, 0,  "F" };
+const LSystem lsys_hilbert = { "A",  lsys_hilbert_rules, 2, 90, 0,  "F" };
+const LSystem lsys_gosper  = { "A",  lsys_gosper_rules,  2, 60, 0,  "AB" };
+const LSystem lsys_plant   = { "X",  lsys_plant_rules,   2, 25, 65, "F" };
+
+////////////////////////////////////////////////////////////////////////////////
+// Turtle //////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// The expansion is walked depth first with an explicit stack holding, for
+// each round, the position reached in the current replacement string.  A
+// symbol read at the last round, or with no production, goes to the turtle.
+//
+// The heading is kept as a whole number of turns, so it never drifts.  When
+// the angle divides the circle, directions come from a table.  Runs of steps
+// in one direction are joined into one segment.
+
+typedef void (*lsys_segfn)(void* arg, double x1, double y1, double x2, double y2);
+
+typedef struct {
+    double x, y;
+    int turn;
+    int reversed;       // Turned around an odd number of times
+} lsys_turtle_t;
+
+typedef struct {
+    const char* rules[256];
+    uint8_t draws[256];
+    double angle, heading;  // Radians
+    int period;             // Turns in a full circle, or 0 if not whole
+    double* dirs;           // Unit vectors (x, y) for each of period turns
+    int maxsaved;           // Initial size of the turtle's [ stack
+} lsys_t;
+
+static void lsys_setup(lsys_t* S, const LSystem* L, int depth) {
+    memset(S->rules, 0, sizeof(S->rules));
+    memset(S->draws, 0, sizeof(S->draws));
+    for (int i = 0; i < L->nrules; i++) {
+        S->rules[(uint8_t)L->rules[i].symbol] = L->rules[i].replacement;
+    }
+    for (const char* c = L->draw; *c; c++) {
+        S->draws[(uint8_t)*c] = 1;
+    }
+    S->angle = L->angle * M_PI / 180;
+    S->heading = L->heading * M_PI / 180;
+
+    // With balanced brackets, each round's string can leave at most as many
+    // ['s open as it contains.  The stack grows if that's not enough.
+    int maxopen = 0;
+    for (int i = -1; i < L->nrules; i++) {
+        int open = 0;
+        for (const char* c = (i < 0) ? L->axiom : L->rules[i].replacement; *c; c++) {
+            open += (*c == '[');
+        }
+        maxopen = MAX(maxopen, open);
+    }
+    S->maxsaved = (depth + 1) * maxopen;
+
+    double period = 360 / fabs(L->angle);
+    S->period = (period <= LSYS_MAXPERIOD) ? (int)round(period) : 0;
+    S->dirs = NULL;
+    if (S->period > 0 && fabs(period - S->period) < 1e-9) {
+        S->dirs = malloc(sizeof(double) * 2 * S->period);
+        assert(S->dirs);
+        for (int k = 0; k < S->period; k++) {
+            S->dirs[2*k] = cos(S->heading + k * S->angle);
+            S->dirs[2*k + 1] = sin(S->heading + k * S->angle);
+        }
+    } else {
+        S->period = 0;
+    }
+}
+
+static inline void lsys_dir(lsys_t* S, lsys_turtle_t* T, double* dx, double* dy) {
+    if (S->period) {
+        int k = T->turn % S->period;
+        if (k < 0) k += S->period;
+        *dx = S->dirs[2*k];
+        *dy = S->dirs[2*k + 1];
+    } else {
+        *dx = cos(S->heading + T->turn * S->angle);
+        *dy = sin(S->heading + T->turn * S->angle);
+    }
+    if (T->reversed) {
+        *dx = -*dx;
+        *dy = -*dy;
+    }
+}
+
+// Walk the system after depth rounds, passing each segment the turtle draws
+// to fn, in unit steps from the origin.
+static void lsys_walk(const LSystem* L, int depth, lsys_segfn fn, void* arg) {
+    lsys_t S;
+    lsys_setup(&S, L, depth);
+    const char** stack = malloc(sizeof(const char*) * (depth + 1));
+    int capacity = MAX(S.maxsaved, 1), nsaved = 0;
+    lsys_turtle_t* saved = malloc(sizeof(lsys_turtle_t) * capacity);
+    assert(stack && saved);
+
+    lsys_turtle_t T = { 0, 0, 0, 0 };
+    double dx, dy;
+    lsys_dir(&S, &T, &dx, &dy);
+    double sx = 0, sy = 0;      // Start of the segment being drawn
+    int drawing = 0;
+
+    int sp = 0;
+    stack[0] = L->axiom;
+    while (sp >= 0) {
+        uint8_t c = *stack[sp];
+        if (c == '\0') {
+            sp--;
+            continue;
+        }
+        stack[sp]++;
+        if (sp < depth && S.rules[c]) {
+            stack[++sp] = S.rules[c];
+            continue;
+        }
+
+        if (S.draws[c]) {
+            if (!drawing) {
+                sx = T.x;
+                sy = T.y;
+                drawing = 1;
+            }
+            T.x += dx;
+            T.y += dy;
+            continue;
+        }
+        if (c != 'f' && c != '+' && c != '-' && c != '|' && c != '[' && c != ']') {
+            continue;
+        }
+
+        // Anything else the turtle does ends the segment.
+        if (drawing) {
+            fn(arg, sx, sy, T.x, T.y);
+            drawing = 0;
+        }
+        switch (c) {
+            case 'f':
+                T.x += dx;
+                T.y += dy;
+                break;
+            case '+':
+                T.turn++;
+                break;
+            case '-':
+                T.turn--;
+                break;
+            case '|':
+                T.reversed ^= 1;
+                break;
+            case '[':
+                if (nsaved == capacity) {
+                    capacity *= 2;
+                    saved = realloc(saved, sizeof(lsys_turtle_t) * capacity);
+                    assert(saved);
+                }
+                saved[nsaved++] = T;
+                break;
+            case ']':
+                if (nsaved > 0) T = saved[--nsaved];
+                break;
+        }
+        lsys_dir(&S, &T, &dx, &dy);
+    }
+    if (drawing) {
+        fn(arg, sx, sy, T.x, T.y);
+    }
+
+    free(saved);
+    free(stack);
+    free(S.dirs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Drawing /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    double xmin, ymin, xmax, ymax;
+} lsys_bounds_t;
+
+static void lsys_bound_segment(void* arg, double x1, double y1, double x2, double y2) {
+    lsys_bounds_t* b = arg;
+    b->xmin = MIN(b->xmin, MIN(x1, x2));
+    b->xmax = MAX(b->xmax, MAX(x1, x2));
+    b->ymin = MIN(b->ymin, MIN(y1, y2));
+    b->ymax = MAX(b->ymax, MAX(y1, y2));
+}
+
+typedef struct {
+    BitmapImage* B;
+    DrawFn* d;
+    double ox, oy, scale;   // Pixel position is (ox, oy) + scale * turtle's
+    double halfwidth;
+    BitmapRect clip;
+    BitmapPoint points[4 * LSYS_BATCH];
+    int counts[LSYS_BATCH];
+    int n;
+} lsys_batch_t;
+
+static void lsys_flush(lsys_batch_t* b) {
+    bmp_drawpolygons(b->B, b->points, b->counts, b->n, b->d, FILL_NONZERO);
+    b->n = 0;
+}
+
+// Add the segment's outline, a rectangle running halfwidth past each end, to
+// the batch.  The rectangles all wind the same way, so under the nonzero rule
+// the batch fills as their union.
+static void lsys_draw_segment(void* arg, double x1, double y1, double x2, double y2) {
+    lsys_batch_t* b = arg;
+    x1 = b->ox + b->scale * x1;
+    y1 = b->oy + b->scale * y1;
+    x2 = b->ox + b->scale * x2;
+    y2 = b->oy + b->scale * y2;
+
+    double hw = b->halfwidth;
+    if (MAX(x1, x2) + hw < b->clip.x0 || MIN(x1, x2) - hw > b->clip.x1 ||
+            MAX(y1, y2) + hw < b->clip.y0 || MIN(y1, y2) - hw > b->clip.y1) {
+        return;
+    }
+
+    double len = hypot(x2 - x1, y2 - y1);
+    if (len == 0) return;
+    double ux = (x2 - x1) / len * hw, uy = (y2 - y1) / len * hw;
+    BitmapPoint* P = &b->points[4 * b->n];
+    P[0] = (BitmapPoint){ x1 - ux + uy, y1 - uy - ux };
+    P[1] = (BitmapPoint){ x2 + ux + uy, y2 + uy - ux };
+    P[2] = (BitmapPoint){ x2 + ux - uy, y2 + uy + ux };
+    P[3] = (BitmapPoint){ x1 - ux - uy, y1 - uy + ux };
+    if (++b->n == LSYS_BATCH) lsys_flush(b);
+}
+
+void draw_lsystem(BitmapImage* B, const LSystem* L, int depth,
+        double x, double y, double w, double h, double linewidth,
+        DrawFn* d) {
+    assert(depth >= 0);
+
+    // Find the extent, in steps.
+    lsys_bounds_t bounds = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    lsys_walk(L, depth, &lsys_bound_segment, &bounds);
+    if (bounds.xmin > bounds.xmax) return;
+
+    // Fit it, lines and all, to the area.
+    double bw = bounds.xmax - bounds.xmin, bh = bounds.ymax - bounds.ymin;
+    double sw = (bw > 0) ? (w - linewidth) / bw : INFINITY;
+    double sh = (bh > 0) ? (h - linewidth) / bh : INFINITY;
+    lsys_batch_t* b = malloc(sizeof(lsys_batch_t));
+    assert(b);
+    b->B = B;
+    b->d = d;
+    b->scale = MIN(sw, sh);
+    if (!isfinite(b->scale)) b->scale = 0;
+    b->ox = x + (w - b->scale * bw) / 2 - b->scale * bounds.xmin;
+    b->oy = y + (h - b->scale * bh) / 2 - b->scale * bounds.ymin;
+    b->halfwidth = linewidth / 2;
+    bmp_getclip(B, &b->clip);
+    for (int i = 0; i < LSYS_BATCH; i++) {
+        b->counts[i] = 4;
+    }
+    b->n = 0;
+
+    lsys_walk(L, depth, &lsys_draw_segment, b);
+    lsys_flush(b);
+    free(b);
+}
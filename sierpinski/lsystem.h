@@ -0,0 +1,52 @@
+#ifndef _LSYSTEM_H_
+#define _LSYSTEM_H_
+
+#include <stdint.h>
+#include "bmp.h"
+
+// One production of an L-system: each symbol in the string is replaced by
+// replacement.
+typedef struct {
+    char symbol;
+    const char* replacement;
+} LsysRule;
+
+// An L-system and how to draw it with a turtle.  The turtle understands:
+//
+// * Symbols in draw: move forward one step, drawing a line.
+// * f: move forward one step without drawing.
+// * + and -: turn left and right by angle degrees.
+// * |: turn around.
+// * [ and ]: save and restore the turtle's position and heading.
+//
+// Other symbols only take part in the productions.  The turtle starts out
+// facing heading degrees (0 is the +x direction, 90 is +y).
+typedef struct {
+    const char* axiom;
+    const LsysRule* rules;
+    int nrules;
+    double angle;
+    double heading;
+    const char* draw;
+} LSystem;
+
+// Some classic systems.
+extern const LSystem lsys_dragon;
+extern const LSystem lsys_hilbert;
+extern const LSystem lsys_gosper;
+extern const LSystem lsys_plant;
+
+// Draw an L-system after depth rounds of productions, scaled to fit the w x h
+// area at (x, y) and keeping its aspect ratio.  Lines are linewidth pixels
+// wide, with square ends.
+//
+// The string is never built: productions are expanded as the turtle reads
+// them, keeping one position per round, so memory doesn't grow with the
+// number of segments.  Segments are handed to bmp_drawpolygons in batches,
+// each batch filled as one shape, so pixels where lines in a batch overlap
+// are drawn once.  The system is walked twice, first to find its extent.
+void draw_lsystem(BitmapImage* B, const LSystem* L, int depth,
+        double x, double y, double w, double h, double linewidth,
+        DrawFn* d);
+
+#endif /* _LSYSTEM_H_ */
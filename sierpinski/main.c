@@ -4,6 +4,7 @@
 #include <time.h>
 #include "bmp.h"
 #include "sierpinski.h"
+#include "lsystem.h"
 
 int main(int argc, char* argv[]) {
     // Set up
@@ -16,12 +17,25 @@ int main(int argc, char* argv[]) {
             255, 0, 255, 0, 255, 255);
 
     // Run Sierpinski
-    draw_sier_carpet(B, 128, 128, width-256, height-256, d1, d2);
+    draw_sier_carpet_par(B, 128, 128, width-256, height-256, d1, d2);
 
-    // Write out Sierpinski and clean up
+    // Write out Sierpinski
     bmp_write("sier.bmp", B);
+
+    // Four L-systems, one to each quarter of the image
+    DrawFn* bg = DrawFn_init_rgb(16, 16, 24);
+    bmp_drawrect(B, 0, 0, width, height, bg);
+    int half = width / 2;
+    draw_lsystem(B, &lsys_dragon, 16, 16, 16, half - 32, half - 32, 1, d1);
+    draw_lsystem(B, &lsys_hilbert, 6, half + 16, 16, half - 32, half - 32, 2, d2);
+    draw_lsystem(B, &lsys_gosper, 4, 16, half + 16, half - 32, half - 32, 1.5, d2);
+    draw_lsystem(B, &lsys_plant, 6, half + 16, half + 16, half - 32, half - 32, 1, d1);
+    bmp_write("lsystem.bmp", B);
+
+    // Clean up
     bmp_free(B);
     DrawFn_free(d1);
     DrawFn_free(d2);
+    DrawFn_free(bg);
     return 0;
 }
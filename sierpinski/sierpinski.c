@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "bmp.h"
+#include "parallel.h"
 #include "sierpinski.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -57,6 +58,78 @@ void draw_sier_carpet(BitmapImage* B, unsigned int x, unsigned int y,
     recurse_sier_carpet(B, x, y, w, h, d2);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Parallel recursion //////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// The _par variants fork subtrees onto the work-stealing scheduler in
+// parallel.h and hand subproblems under SIER_PAR_CUTOFF pixels to the serial
+// recursions above.  Subtrees only run concurrently when the regions they draw
+// in are disjoint; where they overlap they run in the serial order, so the
+// output matches the serial version exactly.  DrawFns must be safe to call
+// from several threads at once on different pixels, as the built-in ones are.
+
+#define SIER_PAR_CUTOFF (128 * 128)
+
+typedef struct {
+    BitmapImage* B;
+    unsigned int x, y, w, h;
+    DrawFn* d;
+} sier_task_t;
+
+static void par_sier_carpet(void* arg) {
+    sier_task_t* T = arg;
+    unsigned int x = T->x, y = T->y, w = T->w, h = T->h;
+    if ((uint64_t)w * h < SIER_PAR_CUTOFF) {
+        recurse_sier_carpet(T->B, x, y, w, h, T->d);
+        return;
+    }
+
+    // Draw central sub-rect, as recurse_sier_carpet.
+    unsigned int x1 = x + (w/3);
+    unsigned int x2 = x + (w*2/3);
+    unsigned int x3 = x + w;
+    unsigned int y1 = y + (h/3);
+    unsigned int y2 = y + (h*2/3);
+    unsigned int y3 = y + h;
+    bmp_drawrect(T->B, x1, y1, x2-x1, y2-y1, T->d);
+
+    // Check base case
+    if ((w/3) <= 1 || (h/3) <= 1) return;
+
+    // The eight sub-rects are disjoint, so all of them may run at once.
+    sier_task_t sub[8] = {
+        { T->B, x,  y,  x1-x,  y1-y,  T->d },
+        { T->B, x1, y,  x2-x1, y1-y,  T->d },
+        { T->B, x2, y,  x3-x2, y1-y,  T->d },
+        { T->B, x,  y1, x1-x,  y2-y1, T->d },
+        { T->B, x2, y1, x3-x2, y2-y1, T->d },
+        { T->B, x,  y2, x1-x,  y3-y2, T->d },
+        { T->B, x1, y2, x2-x1, y3-y2, T->d },
+        { T->B, x2, y2, x3-x2, y3-y2, T->d },
+    };
+    par_task tasks[7];
+    for (int i = 0; i < 7; i++) {
+        par_spawn(&tasks[i], &par_sier_carpet, &sub[i]);
+    }
+    par_sier_carpet(&sub[7]);
+    for (int i = 6; i >= 0; i--) {
+        par_sync(&tasks[i]);
+    }
+}
+
+// Parallel version of draw_sier_carpet.
+void draw_sier_carpet_par(BitmapImage* B, unsigned int x, unsigned int y,
+        unsigned int w, unsigned int h,
+        DrawFn* d1, DrawFn* d2) {
+    // Draw enclosing rect
+    bmp_drawrect(B, x, y, w, h, d1);
+
+    // Recurse
+    sier_task_t T = { B, x, y, w, h, d2 };
+    par_run(&par_sier_carpet, &T);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Sierpinski triangle /////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -106,4 +179,84 @@ void draw_sier_triangle(BitmapImage* B, unsigned int x, unsigned int y,
     recurse_sier_triangle(B, x, y, w, h, d2);
 }
 
+// Parallel recursive step.  The top sub-triangle's rows start where the other
+// two end, so it runs alongside them.  The left and right ones share a column
+// and run one after the other.
+static void par_sier_triangle(void* arg) {
+    sier_task_t* T = arg;
+    unsigned int x = T->x, y = T->y, w = T->w, h = T->h;
+    if ((uint64_t)w * h < SIER_PAR_CUTOFF) {
+        recurse_sier_triangle(T->B, x, y, w, h, T->d);
+        return;
+    }
+
+    // Calculate corners of this triangle, as recurse_sier_triangle.
+    unsigned int x1 = x + (w/2);
+    unsigned int y1 = y+1;
+    unsigned int x2 = x + (w/4);
+    unsigned int y2 = y + (h/2);
+    unsigned int x3 = x + ((3*w)/4);
+    unsigned int y3 = y2;
+
+    // Check base case.
+    if (x2 >= x3 || y1 == y2) return;
+
+    // Draw contained triangles
+    bmp_drawtriangle(T->B, x1, y1, x2, y2, x3, y3, T->d);
+
+    // Recurse.
+    sier_task_t top = { T->B, x2, y2, w/2+1, h/2, T->d };
+    sier_task_t left = { T->B, x, y, w/2+1, h/2, T->d };
+    sier_task_t right = { T->B, x1, y, w/2+1, h/2, T->d };
+    par_task task;
+    par_spawn(&task, &par_sier_triangle, &top);
+    par_sier_triangle(&left);
+    par_sier_triangle(&right);
+    par_sync(&task);
+}
+
+// Parallel version of draw_sier_triangle.
+void draw_sier_triangle_par(BitmapImage* B, unsigned int x, unsigned int y,
+        unsigned int w, unsigned int h,
+        DrawFn* d1, DrawFn* d2) {
+    // Draw enclosing triangle.
+    unsigned int x1 = x + (w/2), y1 = y+h-1;
+    unsigned int x2 = x, y2 = y;
+    unsigned int x3 = x+w-1, y3 = y;
+    bmp_drawtriangle(B, x1, y1, x2, y2, x3, y3, d1);
+
+    // Recurse
+    sier_task_t T = { B, x, y, w, h, d2 };
+    par_run(&par_sier_triangle, &T);
+}
+
+// Anti-aliased recursive step.  As above, but in exact (fractional) pixel
+// coordinates rather than rounded ones.
+static void recurse_sier_triangle_aa(BitmapImage* B, double x, double y,
+        double w, double h,
+        DrawFn* d) {
+    // Check base case.  Stop once the triangle is under a pixel across.
+    if (w < 2.0 || h < 2.0) return;
+
+    // Draw contained triangle (same vertex order as the aliased version).
+    bmp_drawtriangle_aa(B, x + w/2, y, x + w/4, y + h/2, x + 3*w/4, y + h/2, d);
+
+    // Recurse on the three sub-triangles.
+    recurse_sier_triangle_aa(B, x + w/4, y + h/2, w/2, h/2, d); // top
+    recurse_sier_triangle_aa(B, x, y, w/2, h/2, d); // left
+    recurse_sier_triangle_aa(B, x + w/2, y, w/2, h/2, d); // right
+}
+
+// Draw an anti-aliased Sierpinski's triangle.  Supply top left corner as (x, y)
+// plus width and height.
+void draw_sier_triangle_aa(BitmapImage* B, double x, double y,
+        double w, double h,
+        DrawFn* d1, DrawFn* d2) {
+    // Draw enclosing triangle.
+    bmp_drawtriangle_aa(B, x + w/2, y + h, x, y, x + w, y, d1);
+
+    // Recurse
+    recurse_sier_triangle_aa(B, x, y, w, h, d2);
+}
+
 #endif /* _SIERPINSKI_H_ */
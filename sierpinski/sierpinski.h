@@ -8,8 +8,26 @@ void draw_sier_triangle(BitmapImage* B,
         unsigned int x, unsigned int y, unsigned int w, unsigned int h,
         DrawFn* d1, DrawFn* d2);
 
+// Anti-aliased version of draw_sier_triangle, in continuous coordinates (see
+// bmp_drawtriangle_aa).
+void draw_sier_triangle_aa(BitmapImage* B,
+        double x, double y, double w, double h,
+        DrawFn* d1, DrawFn* d2);
+
 void draw_sier_carpet(BitmapImage* B,
         unsigned int x, unsigned int y, unsigned int w, unsigned int h,
         DrawFn* d1, DrawFn* d2);
 
+// Parallel versions of the above, for large images.  Independent parts of the
+// recursion run on par_nthreads() threads (see parallel.h); the result is the
+// same as the serial version's.  The DrawFns must be safe to call from several
+// threads at once on different pixels, as the built-in ones are.
+void draw_sier_triangle_par(BitmapImage* B,
+        unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+        DrawFn* d1, DrawFn* d2);
+
+void draw_sier_carpet_par(BitmapImage* B,
+        unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+        DrawFn* d1, DrawFn* d2);
+
 #endif /* _SIERPINSKI_H_ */